@@ -76,7 +76,20 @@ public:
             // Upload pixels into texture
             glBindTexture(GL_TEXTURE_2D, _textureID);
             glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, imageToShow->width, imageToShow->height, 0, GL_RED, GL_UNSIGNED_BYTE, imageToShow->data.data());
+            
+            // Only reallocate the storage when the size or format changes.
+            const GLint internalFormat = GL_RGBA;
+            if (imageToShow->width == _textureWidth && imageToShow->height == _textureHeight && internalFormat == _textureInternalFormat)
+            {
+                glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, imageToShow->width, imageToShow->height, GL_RED, GL_UNSIGNED_BYTE, imageToShow->data.data());
+            }
+            else
+            {
+                glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, imageToShow->width, imageToShow->height, 0, GL_RED, GL_UNSIGNED_BYTE, imageToShow->data.data());
+                _textureWidth = imageToShow->width;
+                _textureHeight = imageToShow->height;
+                _textureInternalFormat = internalFormat;
+            }
             _imageDataUploadedToTexture = imageToShow->data.data();
         }
         
@@ -108,6 +121,9 @@ private:
     } concurrent;
     
     GLuint _textureID = 0;
+    int _textureWidth = 0;
+    int _textureHeight = 0;
+    GLint _textureInternalFormat = 0;
     uint8_t* _imageDataUploadedToTexture = nullptr;
 };
 
@@ -0,0 +1,343 @@
+// ImGui CVLog, see LICENSE for Copyright information (permissive MIT).
+
+// Measures the producer throughput and the render cost on the headless path,
+// without any window or GPU. Prints one JSON object per scenario on stdout.
+//
+// Usage: benchmark_glfw_opencv [--scenario name] [--seconds 2] [--threads 4] [--windows 4] [--fps 60]
+//
+// The windows of a scenario stay alive during the following ones, and the peak
+// RSS is for the whole process, so run a single scenario per process when
+// comparing them across versions.
+
+#include "imgui_cvlog_gl_opencv.h"
+#include "imgui.h"
+
+#include <opencv2/core.hpp>
+
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+using Clock = std::chrono::steady_clock;
+
+struct Options
+{
+    std::string scenario; // all of them when empty.
+    double seconds = 2.0;
+    int numThreads = 4;
+    int numImageWindows = 4;
+    double fps = 60.0; // pace the frames like vsync would, 0 to run them back to back.
+};
+
+// Timing every call would cost as much as some of the calls being measured.
+constexpr int LatencySamplingPeriod = 16;
+
+struct ProducerStats
+{
+    uint64_t numOps = 0;
+    std::vector<float> latenciesNs;
+};
+
+struct Result
+{
+    std::string scenario;
+    std::string parameters; // already formatted as JSON members.
+    double seconds = 0;
+    uint64_t numOps = 0;
+    std::vector<float> latenciesNs;
+    std::vector<float> frameTimesMs;
+    
+    // Deltas over the scenario, the counters are global.
+    uint64_t numBytesUploaded = 0;
+    uint64_t numDroppedStagedSamples = 0;
+    uint64_t numDroppedTasks = 0;
+};
+
+struct Counters
+{
+    uint64_t numBytesUploaded = 0;
+    uint64_t numDroppedStagedSamples = 0;
+    uint64_t numDroppedTasks = 0;
+    
+    static Counters current(const ImGui::CVLog::HeadlessWindow& headless)
+    {
+        const auto staging = ImGui::CVLog::GetStagingStats();
+        Counters counters;
+        counters.numBytesUploaded = headless.textureUploadStats().numBytesUploaded;
+        counters.numDroppedStagedSamples = staging.numDroppedPlotSamples + staging.numDroppedValues;
+        counters.numDroppedTasks = ImGui::CVLog::GetTaskQueueStats().numDropped;
+        return counters;
+    }
+};
+
+float percentile(std::vector<float>& values, double p)
+{
+    if (values.empty())
+        return 0.f;
+    const size_t k = std::min(values.size() - 1, size_t(p * values.size()));
+    std::nth_element(values.begin(), values.begin() + k, values.end());
+    return values[k];
+}
+
+long peakRssInKB()
+{
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1024; // bytes on macOS.
+#else
+    return usage.ru_maxrss;
+#endif
+}
+
+void printResult(Result& result)
+{
+    const float maxFrameTimeMs = result.frameTimesMs.empty() ? 0.f : *std::max_element(result.frameTimesMs.begin(), result.frameTimesMs.end());
+
+    printf("{\"scenario\":\"%s\",%s"
+           "\"seconds\":%.3f,\"ops\":%llu,\"ops_per_sec\":%.1f,"
+           "\"enqueue_latency_ns\":{\"p50\":%.1f,\"p99\":%.1f},"
+           "\"frames\":%d,\"frame_time_ms\":{\"p50\":%.3f,\"p99\":%.3f,\"max\":%.3f},"
+           "\"uploaded_bytes\":%llu,\"dropped_staged_samples\":%llu,\"dropped_tasks\":%llu,"
+           "\"peak_rss_kb\":%ld}\n",
+           result.scenario.c_str(), result.parameters.c_str(),
+           result.seconds, (unsigned long long)result.numOps, result.numOps / result.seconds,
+           percentile(result.latenciesNs, 0.5), percentile(result.latenciesNs, 0.99),
+           (int)result.frameTimesMs.size(),
+           percentile(result.frameTimesMs, 0.5), percentile(result.frameTimesMs, 0.99), maxFrameTimeMs,
+           (unsigned long long)result.numBytesUploaded,
+           (unsigned long long)result.numDroppedStagedSamples,
+           (unsigned long long)result.numDroppedTasks,
+           peakRssInKB());
+    fflush(stdout);
+}
+
+// Runs the producers in their own threads while the main thread generates the frames.
+// The producer gets its thread index and returns after one operation.
+Result runScenario(ImGui::CVLog::HeadlessWindow& headless,
+                   const Options& options,
+                   int numProducers,
+                   const std::function<void(int threadIndex, uint64_t iteration)>& produceOnce)
+{
+    Result result;
+    std::atomic<bool> stopRequested (false);
+    std::vector<ProducerStats> producerStats (numProducers);
+    std::vector<std::thread> producers;
+
+    const Counters countersAtStart = Counters::current(headless);
+    const auto startTime = Clock::now();
+    for (int threadIndex = 0; threadIndex < numProducers; ++threadIndex)
+    {
+        producers.emplace_back([&, threadIndex]() {
+            auto& stats = producerStats[threadIndex];
+            stats.latenciesNs.reserve(1 << 20);
+            while (!stopRequested.load(std::memory_order_relaxed))
+            {
+                if (stats.numOps % LatencySamplingPeriod == 0)
+                {
+                    const auto opStartTime = Clock::now();
+                    produceOnce(threadIndex, stats.numOps);
+                    stats.latenciesNs.push_back(std::chrono::duration<float, std::nano>(Clock::now() - opStartTime).count());
+                }
+                else
+                {
+                    produceOnce(threadIndex, stats.numOps);
+                }
+                ++stats.numOps;
+            }
+        });
+    }
+
+    const auto frameInterval = std::chrono::duration<double>(options.fps > 0 ? 1.0 / options.fps : 0.0);
+    auto nextFrameTime = startTime;
+    while (Clock::now() - startTime < std::chrono::duration<double>(options.seconds))
+    {
+        const auto frameStartTime = Clock::now();
+        headless.runOnce();
+        result.frameTimesMs.push_back(std::chrono::duration<float, std::milli>(Clock::now() - frameStartTime).count());
+
+        nextFrameTime += std::chrono::duration_cast<Clock::duration>(frameInterval);
+        std::this_thread::sleep_until(nextFrameTime);
+    }
+
+    stopRequested = true;
+    for (auto& producer : producers)
+        producer.join();
+    result.seconds = std::chrono::duration<double>(Clock::now() - startTime).count();
+    
+    const Counters countersAtEnd = Counters::current(headless);
+    result.numBytesUploaded = countersAtEnd.numBytesUploaded - countersAtStart.numBytesUploaded;
+    result.numDroppedStagedSamples = countersAtEnd.numDroppedStagedSamples - countersAtStart.numDroppedStagedSamples;
+    result.numDroppedTasks = countersAtEnd.numDroppedTasks - countersAtStart.numDroppedTasks;
+
+    for (auto& stats : producerStats)
+    {
+        result.numOps += stats.numOps;
+        result.latenciesNs.insert(result.latenciesNs.end(), stats.latenciesNs.begin(), stats.latenciesNs.end());
+    }
+    return result;
+}
+
+#pragma mark - Scenarios
+
+// N threads adding plot values at full speed, each to its own line.
+Result plotProducers(ImGui::CVLog::HeadlessWindow& headless, const Options& options)
+{
+    std::vector<std::string> groupNames;
+    for (int i = 0; i < options.numThreads; ++i)
+        groupNames.push_back("Thread " + std::to_string(i));
+
+    Result result = runScenario(headless, options, options.numThreads, [&](int threadIndex, uint64_t iteration) {
+        ImGui::CVLog::AddPlotValue("Benchmark Plot", groupNames[threadIndex].c_str(), double(iteration % 1000), double(iteration));
+    });
+    result.scenario = "plot_producers";
+    result.parameters = "\"threads\":" + std::to_string(options.numThreads) + ",";
+    return result;
+}
+
+// M image windows, each with its own producer thread updating it at full speed.
+Result imageWindows(ImGui::CVLog::HeadlessWindow& headless, const Options& options,
+                    const char* scenarioName, int width, int height)
+{
+    // Alternate between two images so that each frame has a new one to upload.
+    std::vector<std::string> windowNames;
+    std::vector<cv::Mat> images;
+    for (int i = 0; i < options.numImageWindows; ++i)
+    {
+        windowNames.push_back(std::string(scenarioName) + " " + std::to_string(i));
+        for (int k = 0; k < 2; ++k)
+        {
+            cv::Mat3b image (height, width);
+            memset(image.data, 64 * (k+1), image.total() * image.elemSize());
+            images.push_back(image);
+        }
+    }
+
+    Result result = runScenario(headless, options, options.numImageWindows, [&](int threadIndex, uint64_t iteration) {
+        ImGui::CVLog::UpdateImage(windowNames[threadIndex].c_str(), images[threadIndex*2 + iteration%2]);
+    });
+    result.scenario = scenarioName;
+    result.parameters = "\"windows\":" + std::to_string(options.numImageWindows)
+                        + ",\"width\":" + std::to_string(width)
+                        + ",\"height\":" + std::to_string(height) + ",";
+    return result;
+}
+
+// One value list with 10k keys, updated round-robin by a single thread.
+Result largeValueList(ImGui::CVLog::HeadlessWindow& headless, const Options& options)
+{
+    const int numKeys = 10000;
+    std::vector<std::string> keys;
+    for (int i = 0; i < numKeys; ++i)
+        keys.push_back("Key " + std::to_string(i));
+
+    Result result = runScenario(headless, options, 1, [&](int, uint64_t iteration) {
+        char value[32];
+        snprintf(value, sizeof(value), "%llu", (unsigned long long)iteration);
+        ImGui::CVLog::AddValue("Benchmark ValueList", keys[iteration % numKeys].c_str(), value);
+    });
+    result.scenario = "value_list_10k_keys";
+    result.parameters = "\"keys\":" + std::to_string(numKeys) + ",";
+    return result;
+}
+
+// 1000 windows, with N threads updating them at random through a name lookup.
+Result manyWindows(ImGui::CVLog::HeadlessWindow& headless, const Options& options)
+{
+    const int numWindows = 1000;
+    std::vector<std::string> windowNames;
+    for (int i = 0; i < numWindows; ++i)
+        windowNames.push_back("Benchmark Window " + std::to_string(i));
+
+    Result result = runScenario(headless, options, options.numThreads, [&](int threadIndex, uint64_t iteration) {
+        // Cheap LCG, we only need the windows to be spread out.
+        const uint64_t windowIndex = (iteration * 6364136223846793005ULL + threadIndex * 1442695040888963407ULL) >> 33;
+        ImGui::CVLog::AddValue(windowNames[windowIndex % numWindows].c_str(), "Iteration", "value");
+    });
+    result.scenario = "many_windows";
+    result.parameters = "\"windows\":" + std::to_string(numWindows) + ",\"threads\":" + std::to_string(options.numThreads) + ",";
+    return result;
+}
+
+bool parseOptions(int argc, const char* argv[], Options& options)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        const bool hasValue = i + 1 < argc;
+        if (hasValue && strcmp(argv[i], "--scenario") == 0)
+            options.scenario = argv[++i];
+        else if (hasValue && strcmp(argv[i], "--seconds") == 0)
+            options.seconds = atof(argv[++i]);
+        else if (hasValue && strcmp(argv[i], "--threads") == 0)
+            options.numThreads = std::max(1, atoi(argv[++i]));
+        else if (hasValue && strcmp(argv[i], "--windows") == 0)
+            options.numImageWindows = std::max(1, atoi(argv[++i]));
+        else if (hasValue && strcmp(argv[i], "--fps") == 0)
+            options.fps = atof(argv[++i]);
+        else
+            return false;
+    }
+    return true;
+}
+
+} // anonymous
+
+int main(int argc, const char* argv[])
+{
+    Options options;
+    if (!parseOptions(argc, argv, options))
+    {
+        fprintf(stderr, "Usage: %s [--scenario plot_producers|images_vga|images_1080p|images_4k|value_list_10k_keys|many_windows]"
+                        " [--seconds 2] [--threads 4] [--windows 4] [--fps 60]\n", argv[0]);
+        return 1;
+    }
+
+    ImGui::CVLog::HeadlessWindow headless;
+    headless.initializeContexts();
+
+    // The most expensive to render last, their windows remain for the next scenarios.
+    const std::vector<std::pair<const char*, std::function<Result(void)>>> scenarios = {
+        { "plot_producers", [&]() { return plotProducers(headless, options); } },
+        { "images_vga", [&]() { return imageWindows(headless, options, "images_vga", 640, 480); } },
+        { "images_1080p", [&]() { return imageWindows(headless, options, "images_1080p", 1920, 1080); } },
+        { "images_4k", [&]() { return imageWindows(headless, options, "images_4k", 3840, 2160); } },
+        { "value_list_10k_keys", [&]() { return largeValueList(headless, options); } },
+        { "many_windows", [&]() { return manyWindows(headless, options); } },
+    };
+
+    bool foundScenario = false;
+    for (const auto& scenario : scenarios)
+    {
+        if (!options.scenario.empty() && options.scenario != scenario.first)
+            continue;
+
+        foundScenario = true;
+        Result result = scenario.second();
+        printResult(result);
+
+        // Release the data of the previous scenario.
+        ImGui::CVLog::ClearAll();
+        headless.runOnce();
+    }
+
+    headless.shutDown();
+
+    if (!foundScenario)
+    {
+        fprintf(stderr, "Unknown scenario %s\n", options.scenario.c_str());
+        return 1;
+    }
+    return 0;
+}
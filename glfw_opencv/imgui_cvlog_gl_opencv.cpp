@@ -7,25 +7,75 @@
 
 #include "imgui.h"
 #include "imgui_internal.h"
-#include "imgui/examples/imgui_impl_opengl3.h"
-#include "imgui/examples/imgui_impl_glfw.h"
+#include "imgui/backends/imgui_impl_opengl3.h"
+#include "imgui/backends/imgui_impl_glfw.h"
 #include "implot.h"
 
 #include <opencv2/core.hpp>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <mutex>
 #include <thread>
 #include <unordered_map>
+#include <unordered_set>
 
 namespace ImGui
 {
 namespace CVLog
 {
 
+// Defined with the texture backends below.
+static void ReleaseOpenGLTextureBackends ();
+
 #pragma mark - OpenCVGLWindow
 
 struct OpenCVGLWindow::Impl
 {
     GLFWwindow* window = nullptr;
+    
+    // Read by the wake up callback from the producer threads.
+    std::atomic<bool> idleMode { false };
+    double maxIdleSeconds = 1.0;
+    double maxFPS = 0.0;
+    
+    double lastFrameStartTime = 0.0;
+    
+    // ImGui needs a few frames to settle hover states and layouts after some input.
+    int numFramesToRenderAfterInput = 0;
+    
+    void waitForInputOrNewData ()
+    {
+        if (numFramesToRenderAfterInput > 0)
+        {
+            --numFramesToRenderAfterInput;
+            return;
+        }
+        
+        if (ImGui::CVLog::HasPendingRedraw())
+            return;
+        
+        const double timeout = std::min(maxIdleSeconds, ImGui::CVLog::SecondsUntilNextScheduledUpdate());
+        glfwWaitEventsTimeout(timeout);
+        
+        // Woken up by some input or the timeout.
+        if (!ImGui::CVLog::HasPendingRedraw())
+            numFramesToRenderAfterInput = 2;
+    }
+    
+    void throttle ()
+    {
+        if (maxFPS > 0.0)
+        {
+            const double remainingSeconds = lastFrameStartTime + 1.0 / maxFPS - glfwGetTime();
+            if (remainingSeconds > 0.0)
+                std::this_thread::sleep_for(std::chrono::duration<double>(remainingSeconds));
+        }
+        lastFrameStartTime = glfwGetTime();
+    }
 };
     
 OpenCVGLWindow::OpenCVGLWindow ()
@@ -83,6 +133,13 @@ void OpenCVGLWindow::initializeContexts (const std::string& title,
     ImGui_ImplGlfw_InitForOpenGL(impl->window, true);
     ImGui_ImplOpenGL3_Init();
     
+    // Only posts an empty event for the first update after a frame.
+    Impl* implPtr = impl.get();
+    ImGui::CVLog::SetWakeUpCallback([implPtr]() {
+        if (implPtr->idleMode.load(std::memory_order_relaxed))
+            glfwPostEmptyEvent();
+    });
+    
     // Initial the CVLog settings for the current thread.
     ImGui::CVLog::Init();
 }
@@ -90,6 +147,11 @@ void OpenCVGLWindow::initializeContexts (const std::string& title,
 /// Shutdown the created contexts.
 void OpenCVGLWindow::shutDown ()
 {
+    ImGui::CVLog::SetWakeUpCallback(nullptr);
+    
+    // The workers might still be writing into mapped pixel buffers.
+    ReleaseOpenGLTextureBackends();
+    
     glfwDestroyWindow(impl->window);
     impl->window = nullptr;
     
@@ -108,6 +170,17 @@ void OpenCVGLWindow::run ()
     }
 }
 
+void OpenCVGLWindow::setIdleMode (bool enabled, double maxIdleSeconds)
+{
+    impl->maxIdleSeconds = maxIdleSeconds;
+    impl->idleMode.store(enabled, std::memory_order_relaxed);
+}
+
+void OpenCVGLWindow::setMaxFPS (double maxFPS)
+{
+    impl->maxFPS = maxFPS;
+}
+
 /// Process the window events and rendering
 void OpenCVGLWindow::runOnce ()
 {
@@ -120,6 +193,9 @@ void OpenCVGLWindow::runOnce ()
     // - When io.WantCaptureMouse is true, do not dispatch mouse input data to your main application.
     // - When io.WantCaptureKeyboard is true, do not dispatch keyboard input data to your main application.
     // Generally you may always pass all inputs to dear imgui, and hide them from your application based on those two flags.
+    if (impl->idleMode.load(std::memory_order_relaxed))
+        impl->waitForInputOrNewData();
+    impl->throttle();
     glfwPollEvents();
     
     // Start the Dear ImGui frame
@@ -152,246 +228,1883 @@ void OpenCVGLWindow::runOnce ()
     
     glfwSwapBuffers(impl->window);
 }
-        
-#pragma mark - Images
 
-class ImageWindow : public Window
+#pragma mark - Textures
+
+// Pixel format of the supported cv::Mat types, false for the others.
+static bool GetGLPixelFormat(int type, GLenum& format, GLenum& dataType)
+{
+    switch (type)
+    {
+        case CV_8UC1: format = GL_LUMINANCE; dataType = GL_UNSIGNED_BYTE; return true;
+        case CV_8UC3: format = GL_BGR; dataType = GL_UNSIGNED_BYTE; return true;
+        case CV_8UC4: format = GL_BGRA; dataType = GL_UNSIGNED_BYTE; return true;
+        case CV_32F: format = GL_LUMINANCE; dataType = GL_FLOAT; return true;
+        case CV_32FC3: format = GL_BGR; dataType = GL_FLOAT; return true;
+        case CV_32FC4: format = GL_BGRA; dataType = GL_FLOAT; return true;
+    }
+    return false;
+}
+
+// Large images get streamed through pixel buffer objects: the pixels are copied
+// into a mapped buffer by a worker thread, and the texture gets updated from
+// that buffer on the next frame, so the ImGui thread never waits for the copy
+// nor for the transfer. Small ones are not worth the extra frame of latency.
+class OpenGLTextureBackend : public TextureBackend, public std::enable_shared_from_this<OpenGLTextureBackend>
 {
 public:
-    void Clear() override
+    static constexpr size_t minBytesForStreaming = 256 * 1024;
+    
+    ImTextureID createTexture () override
     {
-        UpdateImage (cv::Mat());
+        registerPerFrameCallbackOnce();
+        
+        GLuint textureID = 0;
+        glGenTextures(1, &textureID);
+        glBindTexture(GL_TEXTURE_2D, textureID);
+        
+        // Setup filtering parameters for display
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        return (ImTextureID)(intptr_t)textureID;
     }
     
-    void UpdateImage (const cv::Mat& newImage)
+    void uploadImage (ImTextureID texture, const cv::Mat& image) override
     {
-        // Don't update it if it's not visible to save on CPU time.
-        if (!isVisible())
+        GLenum format, dataType;
+        if (!GetGLPixelFormat(image.type(), format, dataType))
             return;
         
-        std::lock_guard<std::mutex> _ (concurrent.imageLock);
-        concurrent.image = newImage;
+        // Queued behind a pending one even if small, it would get overwritten otherwise.
+        const GLuint textureID = (GLuint)(intptr_t)texture;
+        const size_t numBytes = image.total() * image.elemSize();
+        if (!GLEW_VERSION_3_0 || (numBytes < minBytesForStreaming && !isUploadPending(texture)))
+        {
+            uploadNow(textureID, image);
+            return;
+        }
+        
+        // Only the latest image matters if the previous one is still being copied.
+        auto& streaming = _streamingUploads[textureID];
+        streaming.nextImage = image;
+        if (!streaming.copy)
+            startCopy(textureID, streaming);
     }
     
-    bool Begin(bool* closed) override
+    bool isUploadPending (ImTextureID texture) const override
     {
-        // Uncomment along with the PopStyleVar to remove the extra padding.
-        // ImGui::PushStyleVar(ImGuiStyleVar_WindowPadding, ImVec2(0,0));
+        auto it = _streamingUploads.find((GLuint)(intptr_t)texture);
+        return it != _streamingUploads.end() && (it->second.copy || it->second.nextImage.data);
+    }
+    
+    // Must run before the context gets destroyed. The textures themselves go away
+    // with the context, they are never deleted individually.
+    void releaseGLResources ()
+    {
+        for (auto& it : _streamingUploads)
+        {
+            const auto& copy = it.second.copy;
+            if (!copy)
+                continue;
+            
+            while (!copy->done.load(std::memory_order_acquire))
+                std::this_thread::yield();
+            
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, copy->pixelBuffer);
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            glDeleteBuffers(1, &copy->pixelBuffer);
+        }
         
-        // Force no scrollbar.
-        bool active = ImGui::Begin(name(), closed, ImGuiWindowFlags_NoScrollbar);
+        for (const auto& buffer : _freePixelBuffers)
+            glDeleteBuffers(1, &buffer.id);
         
-        // ImGui::PopStyleVar();
-        return active;
+        _streamingUploads.clear();
+        _textureStorages.clear();
+        _freePixelBuffers.clear();
+        _registeredPerFrameCallback = false;
     }
     
-    void Render() override
+private:
+    // A mapped pixel buffer filled by a worker thread.
+    struct PixelBufferCopy
     {
-        cv::Mat imageToShow;
+        GLuint pixelBuffer = 0;
+        size_t pixelBufferCapacity = 0;
+        cv::Mat image; // kept alive until copied.
+        std::atomic<bool> done { false };
+    };
+    
+    struct StreamingUpload
+    {
+        cv::Mat nextImage;
+        std::shared_ptr<PixelBufferCopy> copy;
+    };
+    
+    struct PixelBuffer
+    {
+        GLuint id = 0;
+        size_t capacity = 0;
+    };
+    
+    struct TextureStorage
+    {
+        int width = 0;
+        int height = 0;
+        GLint internalFormat = 0;
+    };
+    
+    void uploadNow (GLuint textureID, const cv::Mat& image)
+    {
+        GLenum format, dataType;
+        GetGLPixelFormat(image.type(), format, dataType);
         
+        // Upload pixels into texture
+        glBindTexture(GL_TEXTURE_2D, textureID);
+        // The rows of the downscaled images and of the tiles can have any size in bytes.
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, (GLint)(image.step / image.elemSize()));
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        updateTexture(textureID, image.cols, image.rows, format, dataType, image.data);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    }
+    
+    // The texture must be bound. Only respecifies the storage when the size changes,
+    // reallocating it on every frame shows up in the driver at high frame rates.
+    void updateTexture (GLuint textureID, int width, int height, GLenum format, GLenum dataType, const void* pixels)
+    {
+        const GLint internalFormat = GL_RGBA;
+        TextureStorage& storage = _textureStorages[textureID];
+        if (storage.width == width && storage.height == height && storage.internalFormat == internalFormat)
         {
-            std::lock_guard<std::mutex> _ (concurrent.imageLock);
-            imageToShow = concurrent.image;
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, format, dataType, pixels);
+            return;
         }
         
-        if (!imageToShow.data)
-            return;
+        glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, format, dataType, pixels);
+        storage.width = width;
+        storage.height = height;
+        storage.internalFormat = internalFormat;
+    }
+    
+    void startCopy (GLuint textureID, StreamingUpload& streaming)
+    {
+        auto copy = std::make_shared<PixelBufferCopy>();
+        copy->image = std::move(streaming.nextImage);
+        streaming.nextImage = cv::Mat();
+        
+        const size_t numBytes = copy->image.total() * copy->image.elemSize();
+        PixelBuffer pixelBuffer = acquirePixelBuffer(numBytes);
+        copy->pixelBuffer = pixelBuffer.id;
+        copy->pixelBufferCapacity = std::max(pixelBuffer.capacity, numBytes);
+        
+        // Invalidating lets the driver hand over fresh memory instead of waiting
+        // for a previous transfer from that buffer.
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pixelBuffer.id);
+        if (pixelBuffer.capacity < numBytes)
+            glBufferData(GL_PIXEL_UNPACK_BUFFER, numBytes, nullptr, GL_STREAM_DRAW);
+        uint8_t* mappedData = (uint8_t*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, numBytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
         
-        if (_textureID == 0)
+        if (!mappedData)
         {
-            // Create a OpenGL texture identifier
-            glGenTextures(1, &_textureID);
-            glBindTexture(GL_TEXTURE_2D, _textureID);
-
-            // Setup filtering parameters for display
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            _freePixelBuffers.push_back({copy->pixelBuffer, copy->pixelBufferCapacity});
+            uploadNow(textureID, copy->image);
+            return;
         }
         
-        if (imageToShow.data != _imageDataUploadedToTexture)
+        streaming.copy = copy;
+        RunInWorkerThread([copy, mappedData]() {
+            const cv::Mat& image = copy->image;
+            const size_t rowBytes = image.cols * image.elemSize();
+            if (image.isContinuous())
+                memcpy(mappedData, image.data, rowBytes * image.rows);
+            else
+                for (int r = 0; r < image.rows; ++r)
+                    memcpy(mappedData + r * rowBytes, image.ptr(r), rowBytes);
+            copy->done.store(true, std::memory_order_release);
+        });
+    }
+    
+    PixelBuffer acquirePixelBuffer (size_t numBytes)
+    {
+        // Prefer one that is already large enough to avoid reallocating it.
+        auto it = std::find_if(_freePixelBuffers.begin(), _freePixelBuffers.end(), [numBytes](const PixelBuffer& buffer) {
+            return buffer.capacity >= numBytes;
+        });
+        if (it == _freePixelBuffers.end() && !_freePixelBuffers.empty())
+            it = _freePixelBuffers.begin();
+        
+        if (it != _freePixelBuffers.end())
         {
-            // Upload pixels into texture
-            glBindTexture(GL_TEXTURE_2D, _textureID);
-            glPixelStorei(GL_UNPACK_ROW_LENGTH, (GLint)(imageToShow.step / imageToShow.elemSize()));
-            switch (imageToShow.type())
-            {
-                case CV_8UC1:
-                {
-                    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, imageToShow.cols, imageToShow.rows, 0, GL_LUMINANCE, GL_UNSIGNED_BYTE, imageToShow.data);
-                    break;
-                }
-                    
-                case CV_8UC3:
-                {
-                    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, imageToShow.cols, imageToShow.rows, 0, GL_BGR, GL_UNSIGNED_BYTE, imageToShow.data);
-                    break;
-                }
-                    
-                case CV_8UC4:
-                {
-                    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, imageToShow.cols, imageToShow.rows, 0, GL_BGRA, GL_UNSIGNED_BYTE, imageToShow.data);
-                    break;
-                }
-                    
-                case CV_32F:
-                {
-                    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, imageToShow.cols, imageToShow.rows, 0, GL_LUMINANCE, GL_FLOAT, imageToShow.data);
-                    break;
-                }
-                    
-                case CV_32FC3:
-                {
-                    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, imageToShow.cols, imageToShow.rows, 0, GL_BGR, GL_FLOAT, imageToShow.data);
-                    break;
-                }
-                    
-                case CV_32FC4:
-                {
-                    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, imageToShow.cols, imageToShow.rows, 0, GL_BGRA, GL_FLOAT, imageToShow.data);
-                    break;
-                }
-            }
-            
-            glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
-            _imageDataUploadedToTexture = imageToShow.data;
+            PixelBuffer buffer = *it;
+            _freePixelBuffers.erase(it);
+            return buffer;
         }
         
-        if (ImGui::Begin(name()))
+        PixelBuffer buffer;
+        glGenBuffers(1, &buffer.id);
+        return buffer;
+    }
+    
+    // Runs at the beginning of each frame, before the windows.
+    void finishCopies ()
+    {
+        bool hasPendingCopies = false;
+        for (auto& it : _streamingUploads)
         {
-            //            ImGui::BulletText("ImageWindow content");
-            //            ImGui::BulletText("Width: %d", imageToShow->width);
-            //            ImGui::BulletText("Height: %d", imageToShow->height);
-
-            float inputImageAspectRatio = float(imageToShow.rows) / imageToShow.cols;
-            ImVec2 wSize = ImGui::GetContentRegionAvail();
-            float windowContentAspectRatio = wSize.y / wSize.x;
-            if (inputImageAspectRatio <  windowContentAspectRatio)
+            auto& streaming = it.second;
+            if (!streaming.copy)
+                continue;
+            
+            if (!streaming.copy->done.load(std::memory_order_acquire))
             {
-                ImGui::Image((void*)(intptr_t)_textureID, ImVec2(wSize.x, wSize.x*inputImageAspectRatio));
+                hasPendingCopies = true;
+                continue;
             }
-            else
+            
+            const cv::Mat& image = streaming.copy->image;
+            GLenum format, dataType;
+            GetGLPixelFormat(image.type(), format, dataType);
+            
+            // The rows are packed in the buffer, and the data pointer becomes an offset.
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, streaming.copy->pixelBuffer);
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+            glBindTexture(GL_TEXTURE_2D, it.first);
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+            updateTexture(it.first, image.cols, image.rows, format, dataType, nullptr);
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            
+            _freePixelBuffers.push_back({streaming.copy->pixelBuffer, streaming.copy->pixelBufferCapacity});
+            streaming.copy.reset();
+            
+            if (streaming.nextImage.data)
             {
-                ImGui::Image((void*)(intptr_t)_textureID, ImVec2(wSize.y/inputImageAspectRatio, wSize.y));
+                startCopy(it.first, streaming);
+                hasPendingCopies = true;
             }
         }
-        ImGui::End();
+        
+        // Make sure the last images show up in idle mode too.
+        if (hasPendingCopies)
+            RequestRedraw();
     }
     
-private:
-    struct {
-        std::mutex imageLock;
-        cv::Mat image;
-    } concurrent;
+    void registerPerFrameCallbackOnce ()
+    {
+        if (_registeredPerFrameCallback)
+            return;
+        
+        // Not owning it, the backend might get replaced with SetTextureBackend.
+        std::weak_ptr<OpenGLTextureBackend> weakThis = shared_from_this();
+        const std::string callbackName = "CVLog::FinishTextureUploads" + std::to_string((uintptr_t)this);
+        SetPerFrameCallback(callbackName.c_str(), [weakThis]() {
+            if (auto backend = weakThis.lock())
+                backend->finishCopies();
+        });
+        _registeredPerFrameCallback = true;
+        
+        // Replaced ones can still be used by the existing windows.
+        backends().push_back(weakThis);
+    }
+    
+public:
+    // Every backend that created a texture, ImGui thread only.
+    static std::vector<std::weak_ptr<OpenGLTextureBackend>>& backends ()
+    {
+        static std::vector<std::weak_ptr<OpenGLTextureBackend>> backends;
+        return backends;
+    }
     
-    GLuint _textureID = 0;
-    uint8_t* _imageDataUploadedToTexture = nullptr;
+private:
+    std::unordered_map<GLuint, TextureStorage> _textureStorages;
+    std::unordered_map<GLuint, StreamingUpload> _streamingUploads;
+    std::vector<PixelBuffer> _freePixelBuffers;
+    bool _registeredPerFrameCallback = false;
 };
 
-void UpdateImage(const char* windowName,
-                 const cv::Mat& image)
+// ImGui thread only.
+static std::shared_ptr<TextureBackend> g_TextureBackend = std::make_shared<OpenGLTextureBackend>();
+
+void SetTextureBackend (const std::shared_ptr<TextureBackend>& backend)
+{
+    g_TextureBackend = backend ? backend : std::make_shared<OpenGLTextureBackend>();
+}
+
+static void ReleaseOpenGLTextureBackends ()
+{
+    for (const auto& weakBackend : OpenGLTextureBackend::backends())
+        if (auto backend = weakBackend.lock())
+            backend->releaseGLResources();
+    OpenGLTextureBackend::backends().clear();
+}
+
+ImTextureID NullTextureBackend::createTexture ()
+{
+    // Any non-null identifier will do, ImGui never dereferences it.
+    ++_stats.numTexturesCreated;
+    return (ImTextureID)(intptr_t)_stats.numTexturesCreated;
+}
+
+void NullTextureBackend::uploadImage (ImTextureID texture, const cv::Mat& image)
+{
+    ++_stats.numUploads;
+    _stats.numBytesUploaded += image.total() * image.elemSize();
+    _stats.lastUploadWidth = image.cols;
+    _stats.lastUploadHeight = image.rows;
+    _stats.lastUploadType = image.type();
+}
+
+#pragma mark - Headless
+
+struct HeadlessWindow::Impl
+{
+    std::shared_ptr<NullTextureBackend> textureBackend;
+    std::chrono::steady_clock::time_point lastFrameTime;
+};
+
+HeadlessWindow::HeadlessWindow ()
+: impl(new Impl ())
+{
+}
+
+HeadlessWindow::~HeadlessWindow ()
 {
-    ImageWindow* imWindow = FindWindow<ImageWindow> (windowName);
     
-    // The window exists, just update the data.
-    if (imWindow)
-    {
-        imWindow->UpdateImage (image);
-        return;
-    }
+}
+
+void HeadlessWindow::initializeContexts (int displayWidth, int displayHeight)
+{
+    ImGui::CreateContext();
     
-    // Need to create it, enqueue that in the list of tasks for the next frame;
-    std::string windowNameCopy = windowName;
-    RunOnceInImGuiThread([windowNameCopy,image](){
-        ImageWindow* imWindow = FindOrCreateWindow<ImageWindow>(windowNameCopy.c_str());
-        imWindow->UpdateImage(image);
-    });
+    auto& io = ImGui::GetIO();
+    io.ConfigFlags |= ImGuiConfigFlags_DockingEnable;
+    io.DisplaySize = ImVec2(displayWidth, displayHeight);
+    // Don't mess with the settings of the interactive runs.
+    io.IniFilename = nullptr;
+    
+    // Build the font atlas, usually done by the renderer backend.
+    unsigned char* pixels = nullptr;
+    int width = 0, height = 0;
+    io.Fonts->GetTexDataAsRGBA32(&pixels, &width, &height);
+    
+    ImPlot::CreateContext();
+    
+    impl->textureBackend = std::make_shared<NullTextureBackend>();
+    SetTextureBackend(impl->textureBackend);
+    impl->lastFrameTime = std::chrono::steady_clock::now();
+    
+    ImGui::CVLog::Init();
 }
 
-} // CVLog
-} // ImGui
+void HeadlessWindow::shutDown ()
+{
+    SetTextureBackend(nullptr);
+    ImPlot::DestroyContext();
+    ImGui::DestroyContext();
+}
 
-#pragma mark - Plot
+void HeadlessWindow::runOnce (float deltaTime)
+{
+    const auto now = std::chrono::steady_clock::now();
+    if (deltaTime <= 0.f)
+        deltaTime = std::max(std::chrono::duration<float>(now - impl->lastFrameTime).count(), 1e-6f);
+    impl->lastFrameTime = now;
+    
+    ImGui::GetIO().DeltaTime = deltaTime;
+    ImGui::NewFrame();
+    ImGui::CVLog::Render();
+    ImGui::Render();
+}
 
-namespace ImGui
+const TextureUploadStats& HeadlessWindow::textureUploadStats () const
 {
-namespace CVLog
+    return impl->textureBackend->stats();
+}
+        
+#pragma mark - Images
+
+static std::atomic<bool> g_ImageDownscaling { true };
+
+void SetImageDownscaling(bool enabled)
 {
+    g_ImageDownscaling = enabled;
+}
 
-class PlotWindow : public Window
+static inline uint8_t AverageOf(uint32_t sum, uint32_t count) { return uint8_t((sum + count/2) / count); }
+static inline float AverageOf(float sum, float count) { return sum / count; }
+
+// Averages the blocks of factor x factor pixels, the last rows and columns are
+// dropped if they don't fill a block. The rows get summed first, these loops
+// are contiguous so the compiler vectorizes them.
+template <typename T, typename SumT>
+static void DownscaleWithBoxFilter(const cv::Mat& image, int factor, cv::Mat& downscaled)
 {
-public:
-    void Clear() override
+    const int channels = image.channels();
+    downscaled.create(image.rows / factor, image.cols / factor, image.type());
+    
+    const int rowLength = downscaled.cols * factor * channels;
+    std::vector<SumT> rowSums (rowLength);
+    const SumT blockArea = SumT(factor * factor);
+    for (int r = 0; r < downscaled.rows; ++r)
     {
-        std::lock_guard<std::mutex> _ (concurrent.lock);
-        _groupData.clear ();
-        _previousLimits = {};
-        _autoFitEnabled = true;
+        std::fill(rowSums.begin(), rowSums.end(), SumT(0));
+        for (int k = 0; k < factor; ++k)
+        {
+            const T* imageRow = image.ptr<T>(r * factor + k);
+            for (int i = 0; i < rowLength; ++i)
+                rowSums[i] += imageRow[i];
+        }
+        
+        T* downscaledRow = downscaled.ptr<T>(r);
+        for (int c = 0; c < downscaled.cols; ++c)
+        {
+            const SumT* blockSums = rowSums.data() + c * factor * channels;
+            for (int ch = 0; ch < channels; ++ch)
+            {
+                SumT sum = 0;
+                for (int k = 0; k < factor; ++k)
+                    sum += blockSums[k * channels + ch];
+                downscaledRow[c * channels + ch] = AverageOf(sum, blockArea);
+            }
+        }
+    }
+}
+
+// The depths that the textures support, the other ones don't get uploaded anyway.
+static bool CanDownscaleWithBoxFilter(const cv::Mat& image)
+{
+    return image.depth() == CV_8U || image.depth() == CV_32F;
+}
+
+static void DownscaleWithBoxFilter(const cv::Mat& image, int factor, cv::Mat& downscaled)
+{
+    IM_ASSERT(CanDownscaleWithBoxFilter(image));
+    if (image.depth() == CV_32F)
+        DownscaleWithBoxFilter<float, float>(image, factor, downscaled);
+    else
+        DownscaleWithBoxFilter<uint8_t, uint32_t>(image, factor, downscaled);
+}
+
+// One channel of the pixel as a double, whatever the depth.
+static double ReadChannelValue(const uint8_t* pixel, int depth, int channel)
+{
+    switch (depth)
+    {
+        case CV_8U: return ((const uint8_t*)pixel)[channel];
+        case CV_8S: return ((const int8_t*)pixel)[channel];
+        case CV_16U: return ((const uint16_t*)pixel)[channel];
+        case CV_16S: return ((const int16_t*)pixel)[channel];
+        case CV_32S: return ((const int32_t*)pixel)[channel];
+        case CV_32F: return ((const float*)pixel)[channel];
+        case CV_64F: return ((const double*)pixel)[channel];
+    }
+    return 0.0;
+}
+
+// Zoom and pan of an image drawn on a canvas, ImGui thread only.
+struct ImageView
+{
+    static constexpr float maxZoom = 64.f;
+    
+    // Follows the size of the canvas until the user zooms or pans.
+    bool fitted = true;
+    float zoom = 0.f; // screen points per image pixel, 0 until the first update.
+    ImVec2 center = ImVec2(0,0); // image coordinates shown at the center of the canvas.
+    ImVec2 canvasMin = ImVec2(0,0);
+    ImVec2 canvasSize = ImVec2(1,1);
+    
+    float fitZoom (const ImVec2& imageSize) const
+    {
+        return std::min(canvasSize.x / imageSize.x, canvasSize.y / imageSize.y);
+    }
+    
+    void fit (const ImVec2& imageSize)
+    {
+        fitted = true;
+        zoom = fitZoom(imageSize);
+        center = ImVec2(imageSize.x * 0.5f, imageSize.y * 0.5f);
+    }
+    
+    // Takes the remaining content region with an invisible button. The mouse
+    // wheel zooms around the cursor, dragging pans and double-clicking fits.
+    void update (const char* canvasId, const ImVec2& imageSize)
+    {
+        canvasMin = ImGui::GetCursorScreenPos();
+        canvasSize = ImGui::GetContentRegionAvail();
+        canvasSize = ImVec2(std::max(canvasSize.x, 1.f), std::max(canvasSize.y, 1.f));
+        ImGui::InvisibleButton(canvasId, canvasSize);
+        
+        if (fitted)
+            fit(imageSize);
+        
+        const ImGuiIO& io = ImGui::GetIO();
+        if (ImGui::IsItemHovered())
+        {
+            if (ImGui::IsMouseDoubleClicked(ImGuiMouseButton_Left))
+            {
+                fit(imageSize);
+            }
+            else if (io.MouseWheel != 0.f)
+            {
+                // Keep the image point under the cursor in place.
+                const ImVec2 pointUnderCursor = screenToImage(io.MousePos);
+                const float minZoom = std::min(fitZoom(imageSize) * 0.5f, 1.f);
+                zoom = ImClamp(zoom * powf(1.2f, io.MouseWheel), minZoom, maxZoom);
+                fitted = false;
+                center.x = pointUnderCursor.x - (io.MousePos.x - canvasMin.x - canvasSize.x * 0.5f) / zoom;
+                center.y = pointUnderCursor.y - (io.MousePos.y - canvasMin.y - canvasSize.y * 0.5f) / zoom;
+            }
+        }
+        
+        if (ImGui::IsItemActive() && ImGui::IsMouseDragging(ImGuiMouseButton_Left))
+        {
+            center.x -= io.MouseDelta.x / zoom;
+            center.y -= io.MouseDelta.y / zoom;
+            fitted = false;
+        }
+    }
+    
+    ImVec2 imageToScreen (const ImVec2& p) const
+    {
+        return ImVec2(canvasMin.x + canvasSize.x * 0.5f + (p.x - center.x) * zoom,
+                      canvasMin.y + canvasSize.y * 0.5f + (p.y - center.y) * zoom);
+    }
+    
+    ImVec2 screenToImage (const ImVec2& p) const
+    {
+        return ImVec2(center.x + (p.x - canvasMin.x - canvasSize.x * 0.5f) / zoom,
+                      center.y + (p.y - canvasMin.y - canvasSize.y * 0.5f) / zoom);
+    }
+};
+
+class ImageWindow : public Window
+{
+public:
+    void Clear() override
+    {
+        std::lock_guard<std::mutex> _ (concurrent.imageLock);
+        concurrent.image = cv::Mat();
+    }
+    
+    void UpdateImage (const cv::Mat& newImage)
+    {
+        // Rejected here, the view and the pixel readout would follow an image
+        // that never reaches the texture otherwise.
+        GLenum format, dataType;
+        if (newImage.data && !GetGLPixelFormat(newImage.type(), format, dataType))
+        {
+            IM_ASSERT(false && "UpdateImage only supports CV_8UC1/3/4 and CV_32FC1/3/4 images");
+            return;
+        }
+        
+        // Don't update it if it's not visible or too frequent to save on CPU time.
+        if (!acceptsUpdate())
+            return;
+        
+        {
+            auto lock = lockMeasuringWait(concurrent.imageLock);
+            concurrent.image = newImage;
+        }
+        RequestRedraw();
+    }
+    
+    bool Begin(bool* closed) override
+    {
+        // Uncomment along with the PopStyleVar to remove the extra padding.
+        // ImGui::PushStyleVar(ImGuiStyleVar_WindowPadding, ImVec2(0,0));
+        
+        // Force no scrollbar, the mouse wheel zooms.
+        bool active = ImGui::Begin(name(), closed, ImGuiWindowFlags_NoScrollbar | ImGuiWindowFlags_NoScrollWithMouse);
+        
+        // ImGui::PopStyleVar();
+        return active;
+    }
+    
+    void Render() override
+    {
+        cv::Mat imageToShow;
+        
+        {
+            std::lock_guard<std::mutex> _ (concurrent.imageLock);
+            imageToShow = concurrent.image;
+        }
+        
+        if (!imageToShow.data)
+        {
+            _shown = TextureContent();
+            _next = TextureContent();
+            return;
+        }
+        
+        if (!_texture)
+        {
+            _textureBackend = g_TextureBackend;
+            _texture = _textureBackend->createTexture();
+        }
+        
+        // One downscaling at a time, the newer images wait for the next frames.
+        if (_downscaling && _downscaling->done.load(std::memory_order_acquire))
+        {
+            upload(_downscaling->downscaled, _downscaling->image, _downscaling->rect, _downscaling->level);
+            _downscaling.reset();
+        }
+        
+        if (imageToShow.size() != _shown.image.size())
+            _view.fitted = true;
+        
+        cv::Rect visibleRect;
+        int downscalingLevel = 0;
+        visibleRegion(imageToShow, visibleRect, downscalingLevel);
+        
+        const bool newImage = (imageToShow.data != _uploaded.imageData);
+        const bool needsUpload = (newImage
+                                  || downscalingLevel != _uploaded.level
+                                  || (visibleRect & _uploaded.rect) != visibleRect);
+        if (needsUpload && !_downscaling)
+        {
+            // A margin around the visible region, so small pans don't need a new upload.
+            const cv::Rect imageRect (0, 0, imageToShow.cols, imageToShow.rows);
+            cv::Rect rect = visibleRect;
+            if (rect != imageRect)
+            {
+                const int marginX = rect.width / 2;
+                const int marginY = rect.height / 2;
+                rect = cv::Rect(rect.x - marginX, rect.y - marginY, rect.width + 2 * marginX, rect.height + 2 * marginY) & imageRect;
+            }
+            
+            // A region of the retained image, uploaded in place with its row length.
+            if (downscalingLevel == 0)
+                upload(imageToShow(rect), imageToShow, rect, 0);
+            else
+                startDownscaling(imageToShow, rect, downscalingLevel);
+            
+            _uploaded.imageData = imageToShow.data;
+            _uploaded.rect = rect;
+            _uploaded.level = downscalingLevel;
+            if (newImage)
+                reportSamplesIngested(1);
+        }
+        
+        RenderStale();
+    }
+    
+    // Shows the current texture, the new image waits for the next Render.
+    void RenderStale() override
+    {
+        // The upload can reach the texture a few frames later.
+        if (_next.image.data && !_textureBackend->isUploadPending(_texture))
+        {
+            _shown = _next;
+            _next = TextureContent();
+        }
+        
+        if (!_shown.image.data)
+            return;
+        
+        if (ImGui::Begin(name()))
+        {
+            const ImVec2 imageSize (_shown.image.cols, _shown.image.rows);
+            _view.update("##image", imageSize);
+            
+            // In framebuffer pixels, used to pick the resolution of the next uploads.
+            const ImVec2 framebufferScale = ImGui::GetIO().DisplayFramebufferScale;
+            _displayedSize = ImVec2(imageSize.x * _view.zoom * framebufferScale.x, imageSize.y * _view.zoom * framebufferScale.y);
+            
+            const bool canvasHovered = ImGui::IsItemHovered();
+            const ImVec2 canvasMax (_view.canvasMin.x + _view.canvasSize.x, _view.canvasMin.y + _view.canvasSize.y);
+            const cv::Rect& rect = _shown.rect;
+            ImDrawList* drawList = ImGui::GetWindowDrawList();
+            drawList->PushClipRect(_view.canvasMin, canvasMax, true);
+            drawList->AddImage(_texture,
+                               _view.imageToScreen(ImVec2(rect.x, rect.y)),
+                               _view.imageToScreen(ImVec2(rect.x + rect.width, rect.y + rect.height)));
+            drawList->PopClipRect();
+            
+            if (canvasHovered)
+                showPixelUnderCursor();
+        }
+        ImGui::End();
+    }
+    
+private:
+    // What the texture has, rect is in the coordinates of the full image.
+    struct TextureContent
+    {
+        cv::Mat image; // retained for the pixel values under the cursor.
+        cv::Rect rect;
+    };
+    
+    // Filled by a worker thread.
+    struct Downscaling
+    {
+        cv::Mat image;
+        cv::Rect rect;
+        int level = 0;
+        cv::Mat downscaled;
+        std::atomic<bool> done { false };
+    };
+    
+    // The part of the image visible in the last frame, and the downscaling level
+    // that keeps at least one pixel per framebuffer pixel. The full image until
+    // the first frame is drawn.
+    void visibleRegion (const cv::Mat& image, cv::Rect& rect, int& level) const
+    {
+        const cv::Rect imageRect (0, 0, image.cols, image.rows);
+        rect = imageRect;
+        level = downscalingLevelForDisplay(image);
+        if (_view.fitted || _view.zoom <= 0.f)
+            return;
+        
+        const ImVec2 topLeft = _view.screenToImage(_view.canvasMin);
+        const ImVec2 bottomRight = _view.screenToImage(ImVec2(_view.canvasMin.x + _view.canvasSize.x, _view.canvasMin.y + _view.canvasSize.y));
+        const int x0 = (int)floorf(topLeft.x);
+        const int y0 = (int)floorf(topLeft.y);
+        const cv::Rect visibleRect = cv::Rect(x0, y0, (int)ceilf(bottomRight.x) - x0, (int)ceilf(bottomRight.y) - y0) & imageRect;
+        if (visibleRect.area() > 0)
+            rect = visibleRect;
+    }
+    
+    // Each level halves the resolution, the largest one that still covers the
+    // displayed size. Changes at powers of two only, so resizing the window
+    // does not trigger a new downscaling on each frame.
+    int downscalingLevelForDisplay (const cv::Mat& image) const
+    {
+        if (!g_ImageDownscaling || !CanDownscaleWithBoxFilter(image) || _displayedSize.x < 1.f || _displayedSize.y < 1.f)
+            return 0;
+        
+        int level = 0;
+        while (level < 8
+               && (image.cols >> (level + 1)) >= _displayedSize.x
+               && (image.rows >> (level + 1)) >= _displayedSize.y)
+        {
+            ++level;
+        }
+        return level;
+    }
+    
+    void startDownscaling (const cv::Mat& image, const cv::Rect& rect, int level)
+    {
+        auto downscaling = std::make_shared<Downscaling>();
+        downscaling->image = image;
+        downscaling->rect = rect;
+        downscaling->level = level;
+        _downscaling = downscaling;
+        
+        RunInWorkerThread([downscaling]() {
+            DownscaleWithBoxFilter(downscaling->image(downscaling->rect), 1 << downscaling->level, downscaling->downscaled);
+            downscaling->done.store(true, std::memory_order_release);
+            RequestRedraw();
+        });
+    }
+    
+    // The box filter drops the incomplete blocks, the texture covers slightly less than rect.
+    void upload (const cv::Mat& pixels, const cv::Mat& image, const cv::Rect& rect, int level)
+    {
+        _textureBackend->uploadImage(_texture, pixels);
+        _next.image = image;
+        _next.rect = cv::Rect(rect.x, rect.y, pixels.cols << level, pixels.rows << level);
+        reportBytesUploaded(pixels.total() * pixels.elemSize());
+    }
+    
+    // Raw values read from the retained image, without reading the texture back.
+    void showPixelUnderCursor () const
+    {
+        const cv::Mat& image = _shown.image;
+        const ImVec2 point = _view.screenToImage(ImGui::GetIO().MousePos);
+        const int x = (int)floorf(point.x);
+        const int y = (int)floorf(point.y);
+        if (x < 0 || y < 0 || x >= image.cols || y >= image.rows)
+            return;
+        
+        double values[4] = {0,0,0,0};
+        const int numChannels = std::min(image.channels(), 4);
+        const uint8_t* pixel = image.ptr(y) + x * image.elemSize();
+        for (int c = 0; c < numChannels; ++c)
+            values[c] = ReadChannelValue(pixel, image.depth(), c);
+        
+        static const char* channelNames[4][4] = { {""}, {"", ""}, {"B ", "G ", "R "}, {"B ", "G ", "R ", "A "} };
+        const bool isFloat = (image.depth() == CV_32F || image.depth() == CV_64F);
+        char text[128];
+        int length = 0;
+        for (int c = 0; c < numChannels; ++c)
+        {
+            length += snprintf(text + length, sizeof(text) - length, isFloat ? "%s%.6g  " : "%s%.0f  ", channelNames[numChannels-1][c], values[c]);
+        }
+        
+        // BGR(A) or gray, normalized like the texture.
+        const double maxValue = isFloat ? 1.0 : (image.depth() == CV_16U ? 65535.0 : 255.0);
+        ImVec4 color (values[0] / maxValue, values[0] / maxValue, values[0] / maxValue, 1.f);
+        if (numChannels >= 3)
+            color = ImVec4(values[2] / maxValue, values[1] / maxValue, values[0] / maxValue, 1.f);
+        
+        ImGui::BeginTooltip();
+        ImGui::ColorButton("##pixel", color, ImGuiColorEditFlags_NoTooltip | ImGuiColorEditFlags_NoAlpha);
+        ImGui::SameLine();
+        ImGui::Text("(%d, %d)  %s", x, y, text);
+        ImGui::TextDisabled("Zoom %.0f%%, double-click to fit", _view.zoom * 100.f);
+        ImGui::EndTooltip();
+    }
+    
+private:
+    struct {
+        std::mutex imageLock;
+        cv::Mat image;
+    } concurrent;
+    
+    std::shared_ptr<TextureBackend> _textureBackend;
+    ImTextureID _texture = nullptr;
+    
+    // What got sent to the backend, what is in the texture and what will be once the upload is done.
+    struct {
+        uint8_t* imageData = nullptr;
+        cv::Rect rect;
+        int level = 0;
+    } _uploaded;
+    TextureContent _shown;
+    TextureContent _next;
+    
+    ImageView _view;
+    ImVec2 _displayedSize = ImVec2(0,0);
+    std::shared_ptr<Downscaling> _downscaling;
+};
+
+void UpdateImage(const char* windowName,
+                 const cv::Mat& image)
+{
+    UpdateImage(HashedName(windowName, ImHashStr(windowName)), image);
+}
+
+void UpdateImage(const HashedName& windowName,
+                 const cv::Mat& image)
+{
+    ImageWindow* imWindow = FindWindow<ImageWindow> (windowName);
+    
+    // The window exists, just update the data.
+    if (imWindow)
+    {
+        imWindow->UpdateImage (image);
+        return;
+    }
+    
+    // Need to create it, enqueue that in the list of tasks for the next frame;
+    auto storage = TaskStorage::acquire();
+    const char* windowNameCopy = storage.copyString(windowName.name);
+    RunOnceInImGuiThread(Task(std::move(storage), [windowNameCopy,image](){
+        ImageWindow* imWindow = FindOrCreateWindow<ImageWindow>(windowNameCopy);
+        imWindow->UpdateImage(image);
+    }));
+}
+
+ImageHandle GetImage(const char* windowName)
+{
+    return GetWindowHandle<ImageWindow>(windowName);
+}
+
+void UpdateImage(const ImageHandle& window,
+                 const cv::Mat& image)
+{
+    ImageWindow* imWindow = window.window();
+    
+    // Not created yet, go through the slow path.
+    if (!imWindow)
+    {
+        IM_ASSERT (window); // use GetImage/GetPlot/GetValueList to get a valid handle.
+        UpdateImage(window.name(), image);
+        return;
+    }
+    
+    imWindow->UpdateImage (image);
+}
+
+void SetImageProvider(const char* windowName,
+                      const std::function<cv::Mat(void)>& provider,
+                      double refreshIntervalInSeconds,
+                      bool runInWorkerThread)
+{
+    if (!provider)
+    {
+        SetWindowProvider(windowName, nullptr);
+        return;
+    }
+    
+    // Creates the window right away so it shows up in the window list.
+    ImageHandle window = GetImage(windowName);
+    SetWindowProvider(windowName, [window, provider]() {
+        cv::Mat image = provider();
+        if (!image.empty())
+            UpdateImage(window, image);
+    }, refreshIntervalInSeconds, runInWorkerThread);
+}
+
+} // CVLog
+} // ImGui
+
+#pragma mark - Tiled images
+
+namespace ImGui
+{
+namespace CVLog
+{
+
+// Filled by a worker thread. Each level halves the previous one, until it fits in a single tile.
+struct TilePyramid
+{
+    static constexpr int tileSize = 256;
+    
+    uint64_t id = 0;
+    std::vector<cv::Mat> levels; // level 0 is the image itself.
+    std::atomic<bool> ready { false };
+    
+    void build (const cv::Mat& image)
+    {
+        levels.push_back(image);
+        while (std::max(levels.back().cols, levels.back().rows) > tileSize
+               && std::min(levels.back().cols, levels.back().rows) >= 2)
+        {
+            cv::Mat nextLevel;
+            DownscaleWithBoxFilter(levels.back(), 2, nextLevel);
+            levels.push_back(nextLevel);
+        }
+    }
+    
+    int numLevels () const { return (int)levels.size(); }
+    int numTilesX (int level) const { return (levels[level].cols + tileSize - 1) / tileSize; }
+    int numTilesY (int level) const { return (levels[level].rows + tileSize - 1) / tileSize; }
+    
+    // Smaller on the right and bottom borders.
+    cv::Rect tileRect (int level, int x, int y) const
+    {
+        const cv::Mat& levelImage = levels[level];
+        return cv::Rect(x * tileSize,
+                        y * tileSize,
+                        std::min(tileSize, levelImage.cols - x * tileSize),
+                        std::min(tileSize, levelImage.rows - y * tileSize));
+    }
+};
+
+struct TileKey
+{
+    uint64_t pyramidId = 0;
+    int level = 0;
+    int x = 0;
+    int y = 0;
+    
+    bool operator== (const TileKey& other) const
+    {
+        return pyramidId == other.pyramidId && level == other.level && x == other.x && y == other.y;
+    }
+};
+
+struct TileKeyHash
+{
+    size_t operator() (const TileKey& key) const
+    {
+        const uint64_t tileIndex = (uint64_t(key.level) << 48) ^ (uint64_t(key.y) << 24) ^ uint64_t(key.x);
+        return std::hash<uint64_t>()(key.pyramidId * 0x9E3779B97F4A7C15ull ^ tileIndex);
+    }
+};
+
+static std::atomic<size_t> g_TileMemoryBudget { size_t(256) << 20 };
+
+void SetTileMemoryBudget(size_t numBytes)
+{
+    g_TileMemoryBudget = numBytes;
+}
+
+// The tile textures of all the tiled image windows. Once the budget is reached,
+// a new tile takes the texture of the least recently drawn one. ImGui thread only.
+class TileTextureCache
+{
+public:
+    enum class TileState { Missing, Uploading, Ready };
+    
+    // The textures are RGBA, and the border tiles count as full ones.
+    static constexpr size_t bytesPerTile = TilePyramid::tileSize * TilePyramid::tileSize * 4;
+    
+    // Marks the tile as drawn in this frame, so it does not get replaced.
+    TileState lookup (const TileKey& key, ImTextureID* texture)
+    {
+        resetIfBackendChanged();
+        auto it = _slotIndexByKey.find(key);
+        if (it == _slotIndexByKey.end())
+            return TileState::Missing;
+        
+        Slot& slot = _slots[it->second];
+        slot.lastDrawnFrame = ImGui::GetFrameCount();
+        *texture = slot.texture;
+        return _backend->isUploadPending(slot.texture) ? TileState::Uploading : TileState::Ready;
+    }
+    
+    // False when the budget is reached and all the tiles are drawn in this frame.
+    bool upload (const TileKey& key, const cv::Mat& tile)
+    {
+        resetIfBackendChanged();
+        const int frame = ImGui::GetFrameCount();
+        const size_t maxNumSlots = std::max(g_TileMemoryBudget.load() / bytesPerTile, size_t(1));
+        
+        int slotIndex = -1;
+        if (_slots.size() < maxNumSlots)
+        {
+            Slot slot;
+            slot.texture = _backend->createTexture();
+            _slots.push_back(slot);
+            slotIndex = (int)_slots.size() - 1;
+        }
+        else
+        {
+            // A linear scan is fine for a few thousand tiles.
+            for (int i = 0; i < (int)_slots.size(); ++i)
+            {
+                if (_slots[i].lastDrawnFrame < frame
+                    && (slotIndex < 0 || _slots[i].lastDrawnFrame < _slots[slotIndex].lastDrawnFrame))
+                {
+                    slotIndex = i;
+                }
+            }
+            
+            if (slotIndex < 0)
+                return false;
+            
+            _slotIndexByKey.erase(_slots[slotIndex].key);
+        }
+        
+        Slot& slot = _slots[slotIndex];
+        slot.key = key;
+        slot.lastDrawnFrame = frame;
+        _slotIndexByKey[key] = slotIndex;
+        _backend->uploadImage(slot.texture, tile);
+        return true;
+    }
+    
+    size_t numTiles () const { return _slots.size(); }
+    
+private:
+    // The textures of the previous backend get abandoned, like the ones of the image windows.
+    void resetIfBackendChanged ()
+    {
+        if (_backend == g_TextureBackend)
+            return;
+        
+        _backend = g_TextureBackend;
+        _slots.clear();
+        _slotIndexByKey.clear();
+    }
+    
+private:
+    struct Slot
+    {
+        ImTextureID texture = nullptr;
+        TileKey key;
+        int lastDrawnFrame = -1;
+    };
+    
+    std::shared_ptr<TextureBackend> _backend;
+    std::vector<Slot> _slots;
+    std::unordered_map<TileKey, int, TileKeyHash> _slotIndexByKey;
+};
+
+// ImGui thread only.
+static TileTextureCache g_TileTextureCache;
+static uint64_t g_NextTilePyramidId = 1;
+
+class TiledImageWindow : public Window
+{
+public:
+    // The rest waits for the next frames, showing the coarser levels meanwhile.
+    static constexpr int maxTileUploadsPerFrame = 16;
+    
+    TiledImageWindow ()
+    {
+        static std::once_flag diagnosticsCallbackAdded;
+        std::call_once(diagnosticsCallbackAdded, []() {
+            AddDiagnosticsCallback("Tiles", []() {
+                const size_t numTiles = g_TileTextureCache.numTiles();
+                ImGui::Text("Tile textures: %zu (%.1f MB), budget %.1f MB",
+                            numTiles,
+                            numTiles * TileTextureCache::bytesPerTile / 1e6,
+                            g_TileMemoryBudget.load() / 1e6);
+            });
+        });
+    }
+    
+    void Clear() override
+    {
+        std::lock_guard<std::mutex> _ (concurrent.imageLock);
+        concurrent.image = cv::Mat();
+    }
+    
+    void UpdateImage (const cv::Mat& newImage)
+    {
+        if (!acceptsUpdate())
+            return;
+        
+        {
+            auto lock = lockMeasuringWait(concurrent.imageLock);
+            concurrent.image = newImage;
+        }
+        RequestRedraw();
+    }
+    
+    bool Begin(bool* closed) override
+    {
+        // The mouse wheel zooms.
+        return ImGui::Begin(name(), closed, ImGuiWindowFlags_NoScrollbar | ImGuiWindowFlags_NoScrollWithMouse);
+    }
+    
+    void Render() override
+    {
+        cv::Mat image;
+        
+        {
+            std::lock_guard<std::mutex> _ (concurrent.imageLock);
+            image = concurrent.image;
+        }
+        
+        if (!image.data)
+        {
+            _pyramid.reset();
+            _nextPyramid.reset();
+            _imageDataInPyramid = nullptr;
+            return;
+        }
+        
+        // One pyramid gets built at a time, the newer images wait for it.
+        if (_nextPyramid && _nextPyramid->ready.load(std::memory_order_acquire))
+        {
+            const cv::Mat& nextImage = _nextPyramid->levels[0];
+            if (!_pyramid || _pyramid->levels[0].size() != nextImage.size())
+                _view.fitted = true;
+            
+            _pyramid = std::move(_nextPyramid);
+            reportSamplesIngested(1);
+        }
+        
+        if (image.data != _imageDataInPyramid && !_nextPyramid)
+            startBuildingPyramid(image);
+        
+        render(maxTileUploadsPerFrame);
+    }
+    
+    // Only draws the tiles that are already uploaded.
+    void RenderStale() override
+    {
+        render(0);
+    }
+    
+private:
+    void startBuildingPyramid (const cv::Mat& image)
+    {
+        auto pyramid = std::make_shared<TilePyramid>();
+        pyramid->id = g_NextTilePyramidId++;
+        _nextPyramid = pyramid;
+        _imageDataInPyramid = image.data;
+        
+        RunInWorkerThread([pyramid, image]() {
+            pyramid->build(image);
+            pyramid->ready.store(true, std::memory_order_release);
+            RequestRedraw();
+        });
+    }
+    
+    void render (int maxTileUploads)
+    {
+        if (ImGui::Begin(name()))
+        {
+            if (_pyramid)
+                renderTiles(maxTileUploads);
+            else if (_nextPyramid)
+                ImGui::TextDisabled("Building the tile pyramid...");
+        }
+        ImGui::End();
+    }
+    
+    void renderTiles (int maxTileUploads)
+    {
+        const TilePyramid& pyramid = *_pyramid;
+        const ImVec2 imageSize (pyramid.levels[0].cols, pyramid.levels[0].rows);
+        _view.update("##tiles", imageSize);
+        
+        // The coarsest level that still has one pixel per framebuffer pixel.
+        const float imagePixelsPerFramebufferPixel = 1.f / (_view.zoom * ImGui::GetIO().DisplayFramebufferScale.x);
+        int targetLevel = 0;
+        while (targetLevel + 1 < pyramid.numLevels() && float(2 << targetLevel) <= imagePixelsPerFramebufferPixel)
+            ++targetLevel;
+        
+        const ImVec2 canvasMax (_view.canvasMin.x + _view.canvasSize.x, _view.canvasMin.y + _view.canvasSize.y);
+        const ImVec2 visibleMin = _view.screenToImage(_view.canvasMin);
+        const ImVec2 visibleMax = _view.screenToImage(canvasMax);
+        
+        ImDrawList* drawList = ImGui::GetWindowDrawList();
+        drawList->PushClipRect(_view.canvasMin, canvasMax, true);
+        
+        int numUploads = 0;
+        auto lookupOrUpload = [&](const TileKey& key, bool canUpload, ImTextureID* texture) {
+            auto state = g_TileTextureCache.lookup(key, texture);
+            if (state == TileTextureCache::TileState::Missing && canUpload && numUploads < maxTileUploads)
+            {
+                const cv::Mat tile = pyramid.levels[key.level](pyramid.tileRect(key.level, key.x, key.y));
+                if (g_TileTextureCache.upload(key, tile))
+                {
+                    ++numUploads;
+                    reportBytesUploaded(tile.total() * tile.elemSize());
+                    state = g_TileTextureCache.lookup(key, texture);
+                }
+            }
+            return state;
+        };
+        
+        // Look up the target level first, the coarser ones only need to be
+        // drawn below it when some of its tiles are not there yet.
+        bool allTargetTilesReady = true;
+        _readyTargetTiles.clear();
+        forEachVisibleTile(targetLevel, visibleMin, visibleMax, [&](const TileKey& key) {
+            ImTextureID texture = nullptr;
+            if (lookupOrUpload(key, true, &texture) == TileTextureCache::TileState::Ready)
+                _readyTargetTiles.push_back(std::make_pair(key, texture));
+            else
+                allTargetTilesReady = false;
+        });
+        
+        if (!allTargetTilesReady)
+        {
+            // The single tile of the top level always gets uploaded, so there is something to show.
+            for (int level = pyramid.numLevels() - 1; level > targetLevel; --level)
+            {
+                const bool canUpload = (level == pyramid.numLevels() - 1);
+                forEachVisibleTile(level, visibleMin, visibleMax, [&](const TileKey& key) {
+                    ImTextureID texture = nullptr;
+                    if (lookupOrUpload(key, canUpload, &texture) == TileTextureCache::TileState::Ready)
+                        drawTile(drawList, key, texture);
+                });
+            }
+            
+            RequestRedraw();
+        }
+        
+        for (const auto& it : _readyTargetTiles)
+            drawTile(drawList, it.first, it.second);
+        
+        drawList->PopClipRect();
+    }
+    
+    template <typename TileFunction>
+    void forEachVisibleTile (int level, const ImVec2& visibleMin, const ImVec2& visibleMax, const TileFunction& f) const
+    {
+        const float tileSizeInImage = float(TilePyramid::tileSize << level);
+        const int firstX = std::max(0, int(visibleMin.x / tileSizeInImage));
+        const int firstY = std::max(0, int(visibleMin.y / tileSizeInImage));
+        const int lastX = std::min(_pyramid->numTilesX(level) - 1, int(visibleMax.x / tileSizeInImage));
+        const int lastY = std::min(_pyramid->numTilesY(level) - 1, int(visibleMax.y / tileSizeInImage));
+        
+        TileKey key;
+        key.pyramidId = _pyramid->id;
+        key.level = level;
+        for (key.y = firstY; key.y <= lastY; ++key.y)
+            for (key.x = firstX; key.x <= lastX; ++key.x)
+                f(key);
+    }
+    
+    void drawTile (ImDrawList* drawList, const TileKey& key, ImTextureID texture) const
+    {
+        const cv::Rect rect = _pyramid->tileRect(key.level, key.x, key.y);
+        const float scale = float(1 << key.level);
+        const ImVec2 p0 = _view.imageToScreen(ImVec2(rect.x * scale, rect.y * scale));
+        const ImVec2 p1 = _view.imageToScreen(ImVec2((rect.x + rect.width) * scale, (rect.y + rect.height) * scale));
+        drawList->AddImage(texture, p0, p1);
+    }
+    
+private:
+    struct {
+        std::mutex imageLock;
+        cv::Mat image;
+    } concurrent;
+    
+    std::shared_ptr<TilePyramid> _pyramid;
+    std::shared_ptr<TilePyramid> _nextPyramid;
+    uint8_t* _imageDataInPyramid = nullptr;
+    ImageView _view;
+    
+    // Cache to avoid reallocating it on every frame.
+    std::vector<std::pair<TileKey, ImTextureID>> _readyTargetTiles;
+};
+
+void UpdateTiledImage(const char* windowName,
+                      const cv::Mat& image)
+{
+    // The pyramid and the tiles need one of the texture types.
+    GLenum format, dataType;
+    if (image.data && !GetGLPixelFormat(image.type(), format, dataType))
+    {
+        IM_ASSERT(false && "UpdateTiledImage only supports CV_8UC1/3/4 and CV_32FC1/3/4 images");
+        return;
+    }
+    
+    TiledImageWindow* window = FindWindow<TiledImageWindow> (HashedName(windowName, ImHashStr(windowName)));
+    
+    // The window exists, just update the data.
+    if (window)
+    {
+        window->UpdateImage (image);
+        return;
+    }
+    
+    // Need to create it, enqueue that in the list of tasks for the next frame;
+    auto storage = TaskStorage::acquire();
+    const char* windowNameCopy = storage.copyString(windowName);
+    RunOnceInImGuiThread(Task(std::move(storage), [windowNameCopy,image](){
+        TiledImageWindow* window = FindOrCreateWindow<TiledImageWindow>(windowNameCopy);
+        window->UpdateImage(image);
+    }));
+}
+
+} // CVLog
+} // ImGui
+
+#pragma mark - Thread staging
+
+namespace ImGui
+{
+namespace CVLog
+{
+
+// Applies to the buffers of each producer thread, see SetStagingLimits.
+struct StagingLimits
+{
+    static constexpr size_t defaultCapacity = 1 << 20;
+    
+    std::atomic<size_t> capacity { defaultCapacity };
+    std::atomic<QueuePolicy> policy { QueuePolicy::DropOldest };
+    std::atomic<int64_t> blockTimeoutNs { 100000000 };
+    
+    std::atomic<uint64_t> numDroppedPlotSamples { 0 };
+    std::atomic<uint64_t> numDroppedValues { 0 };
+    
+    // Only updated when a thread spinlock was contended.
+    std::atomic<uint64_t> numContendedLocks { 0 };
+    std::atomic<uint64_t> totalLockWaitNs { 0 };
+};
+
+static StagingLimits g_StagingLimits;
+
+// Values sent by a producer thread get appended to buffers owned by that
+// thread, and handed over to the ImGui thread once per frame by
+// FlushStagedValues. Producers never share a lock or a counter: the ImGui
+// thread is the only one grabbing each thread spinlock, to swap the buffers.
+class ThreadStaging
+{
+public:
+    struct PlotSample
+    {
+        uint64_t sequence;
+        PlotWindow* window;
+        ImGuiID group;
+        float xValue;
+        float yValue;
+    };
+    
+    struct Value
+    {
+        uint64_t sequence;
+        ValueListWindow* window;
+        size_t nameOffset; // in text.
+        size_t valueOffset; // in text.
+    };
+    
+    struct Buffers
+    {
+        std::vector<PlotSample> plotSamples;
+        std::vector<Value> values;
+        std::vector<char> text; // keeps the capacity, unlike a string per value.
+        
+        void clear()
+        {
+            plotSamples.clear();
+            values.clear();
+            text.clear();
+        }
+    };
+    
+public:
+    // Registers the buffers of the calling thread on first use.
+    static ThreadStaging& current();
+    
+    // Steady clock ticks, gives a global order without sharing a counter.
+    static uint64_t nextSequence()
+    {
+        return std::chrono::steady_clock::now().time_since_epoch().count();
+    }
+    
+    // Producer thread only. Returns true only the first time this thread
+    // sends this group, so the name and style get sent only once.
+    // Not an ImGuiStorage since the ImGui allocator is not thread-safe.
+    bool isNewGroup(const PlotWindow* window, ImGuiID group)
+    {
+        return _groupsSentByThisThread[window].insert(group).second;
+    }
+    
+    // keepLatestOnly replaces the sample of the group already waiting in this
+    // thread buffers instead of adding one, see UpdatePolicy::keepLatestOnly.
+    void addPlotSample(PlotWindow* window, ImGuiID group, float xValue, float yValue, bool keepLatestOnly)
+    {
+        const uint64_t sequence = nextSequence();
+        std::unique_lock<ThreadStaging> lock (*this);
+        if (keepLatestOnly && replaceStagedPlotSample(window, group, xValue, yValue))
+            return;
+        if (!makeRoom(lock, 1, g_StagingLimits.numDroppedPlotSamples))
+            return;
+        appendPlotSample({sequence, window, group, xValue, yValue}, keepLatestOnly);
+        lock.unlock();
+        RequestRedraw();
+    }
+    
+    // The whole batch shares the sequence number, the stable merge keeps its order.
+    // Without xValues the samples get their index in the batch.
+    void addPlotSamples(PlotWindow* window, ImGuiID group, const double* yValues, const double* xValues, int count, bool keepLatestOnly)
+    {
+        if (keepLatestOnly)
+        {
+            addPlotSample(window, group, xValues ? float(xValues[count-1]) : float(count-1), float(yValues[count-1]), true);
+            return;
+        }
+        
+        const uint64_t sequence = nextSequence();
+        std::unique_lock<ThreadStaging> lock (*this);
+        if (!makeRoom(lock, count, g_StagingLimits.numDroppedPlotSamples))
+            return;
+        auto& samples = _producerBuffers.plotSamples;
+        const size_t first = samples.size();
+        samples.resize(first + count);
+        for (int i = 0; i < count; ++i)
+            samples[first + i] = {sequence, window, group, xValues ? float(xValues[i]) : float(i), float(yValues[i])};
+        lock.unlock();
+        RequestRedraw();
+    }
+    
+    void addPlotSamples(PlotWindow* window, const HashedName* groups, const double* yValues, int count, float xValue, bool keepLatestOnly)
+    {
+        const uint64_t sequence = nextSequence();
+        std::unique_lock<ThreadStaging> lock (*this);
+        if (!makeRoom(lock, count, g_StagingLimits.numDroppedPlotSamples))
+            return;
+        if (keepLatestOnly)
+        {
+            for (int i = 0; i < count; ++i)
+            {
+                if (!replaceStagedPlotSample(window, groups[i].id, xValue, float(yValues[i])))
+                    appendPlotSample({sequence, window, groups[i].id, xValue, float(yValues[i])}, true);
+            }
+        }
+        else
+        {
+            auto& samples = _producerBuffers.plotSamples;
+            const size_t first = samples.size();
+            samples.resize(first + count);
+            for (int i = 0; i < count; ++i)
+                samples[first + i] = {sequence, window, groups[i].id, xValue, float(yValues[i])};
+        }
+        lock.unlock();
+        RequestRedraw();
+    }
+    
+    void addValue(ValueListWindow* window, const char* name, const char* value)
+    {
+        addValues(window, &name, &value, 1);
+    }
+    
+    void addValues(ValueListWindow* window, const char* const* names, const char* const* values, int count)
+    {
+        const uint64_t sequence = nextSequence();
+        std::unique_lock<ThreadStaging> lock (*this);
+        if (!makeRoom(lock, count, g_StagingLimits.numDroppedValues))
+            return;
+        auto& text = _producerBuffers.text;
+        for (int i = 0; i < count; ++i)
+        {
+            const size_t nameOffset = text.size();
+            text.insert(text.end(), names[i], names[i] + strlen(names[i]) + 1);
+            const size_t valueOffset = text.size();
+            text.insert(text.end(), values[i], values[i] + strlen(values[i]) + 1);
+            _producerBuffers.values.push_back({sequence, window, nameOffset, valueOffset});
+        }
+        lock.unlock();
+        RequestRedraw();
+    }
+    
+    // ImGui thread only. The returned buffers stay valid until the next call.
+    Buffers& takeBuffers()
+    {
+        _consumerBuffers.clear();
+        std::lock_guard<ThreadStaging> _ (*this);
+        std::swap(_producerBuffers, _consumerBuffers);
+        return _consumerBuffers;
+    }
+    
+    bool empty()
+    {
+        std::lock_guard<ThreadStaging> _ (*this);
+        return _producerBuffers.plotSamples.empty() && _producerBuffers.values.empty();
+    }
+    
+    // Spinlock, only contended during the hand over.
+    void lock()
+    {
+        if (!_lock.test_and_set(std::memory_order_acquire))
+            return;
+        
+        const auto startTime = std::chrono::steady_clock::now();
+        while (_lock.test_and_set(std::memory_order_acquire))
+            std::this_thread::yield();
+        const uint64_t waitNs = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - startTime).count();
+        g_StagingLimits.numContendedLocks.fetch_add(1, std::memory_order_relaxed);
+        g_StagingLimits.totalLockWaitNs.fetch_add(waitNs, std::memory_order_relaxed);
+    }
+    
+    void unlock()
+    {
+        _lock.clear(std::memory_order_release);
+    }
+    
+private:
+    // With the lock held.
+    void appendPlotSample(const PlotSample& sample, bool keepLatestOnly)
+    {
+        auto& samples = _producerBuffers.plotSamples;
+        if (keepLatestOnly)
+            _stagedSampleIndexPerGroup[sample.window][sample.group] = samples.size();
+        samples.push_back(sample);
+    }
+    
+    // With the lock held. The index gets stale once the buffers got handed over
+    // or some samples dropped, it must still point to a sample of that group.
+    bool replaceStagedPlotSample(const PlotWindow* window, ImGuiID group, float xValue, float yValue)
+    {
+        auto& samples = _producerBuffers.plotSamples;
+        auto& indexPerGroup = _stagedSampleIndexPerGroup[window];
+        auto it = indexPerGroup.find(group);
+        if (it == indexPerGroup.end() || it->second >= samples.size())
+            return false;
+        
+        PlotSample& sample = samples[it->second];
+        if (sample.window != window || sample.group != group)
+            return false;
+        
+        sample.xValue = xValue;
+        sample.yValue = yValue;
+        return true;
+    }
+    
+    size_t numPending() const
+    {
+        return _producerBuffers.plotSamples.size() + _producerBuffers.values.size();
+    }
+    
+    // Applies g_StagingLimits before adding numNew items, with the lock held.
+    // Returns false if the new items must be dropped.
+    bool makeRoom(std::unique_lock<ThreadStaging>& lock, size_t numNew, std::atomic<uint64_t>& numDroppedNew)
+    {
+        const size_t capacity = g_StagingLimits.capacity.load(std::memory_order_relaxed);
+        if (capacity == 0 || numPending() + numNew <= capacity)
+            return true;
+        
+        switch (g_StagingLimits.policy.load(std::memory_order_relaxed))
+        {
+            case QueuePolicy::DropNewest:
+                numDroppedNew.fetch_add(numNew, std::memory_order_relaxed);
+                return false;
+                
+            case QueuePolicy::DropOldest:
+                // Drop a bit more than needed so this does not happen on every call.
+                dropOldest(numPending() + numNew - capacity + capacity/16);
+                return true;
+                
+            case QueuePolicy::Block:
+            {
+                // Its own buffers only get flushed by itself on the next frame,
+                // it would wait for nothing. They can go over the capacity instead.
+                if (IsImGuiThread())
+                    return true;
+                
+                const auto deadline = std::chrono::steady_clock::now() + std::chrono::nanoseconds(g_StagingLimits.blockTimeoutNs.load(std::memory_order_relaxed));
+                
+                // A batch bigger than the capacity still goes through once the buffers got flushed.
+                while (numPending() > 0 && numPending() + numNew > capacity)
+                {
+                    if (std::chrono::steady_clock::now() >= deadline)
+                    {
+                        numDroppedNew.fetch_add(numNew, std::memory_order_relaxed);
+                        return false;
+                    }
+                    
+                    // Let FlushStagedValues take the buffers.
+                    lock.unlock();
+                    std::this_thread::sleep_for(std::chrono::microseconds(100));
+                    lock.lock();
+                }
+                return true;
+            }
+        }
+        return true;
+    }
+    
+    // Both buffers are sorted by sequence, drop the oldest ones across the two.
+    void dropOldest(size_t numToDrop)
+    {
+        auto& samples = _producerBuffers.plotSamples;
+        auto& values = _producerBuffers.values;
+        size_t numSamplesToDrop = 0;
+        size_t numValuesToDrop = 0;
+        while (numSamplesToDrop + numValuesToDrop < numToDrop
+               && (numSamplesToDrop < samples.size() || numValuesToDrop < values.size()))
+        {
+            const bool dropSample = numValuesToDrop == values.size()
+                || (numSamplesToDrop < samples.size() && samples[numSamplesToDrop].sequence <= values[numValuesToDrop].sequence);
+            if (dropSample)
+                ++numSamplesToDrop;
+            else
+                ++numValuesToDrop;
+        }
+        
+        samples.erase(samples.begin(), samples.begin() + numSamplesToDrop);
+        g_StagingLimits.numDroppedPlotSamples.fetch_add(numSamplesToDrop, std::memory_order_relaxed);
+        
+        if (numValuesToDrop > 0)
+        {
+            values.erase(values.begin(), values.begin() + numValuesToDrop);
+            g_StagingLimits.numDroppedValues.fetch_add(numValuesToDrop, std::memory_order_relaxed);
+            
+            // The strings are stored in order, drop the ones before the first value left.
+            auto& text = _producerBuffers.text;
+            const size_t numCharsToDrop = values.empty() ? text.size() : values.front().nameOffset;
+            text.erase(text.begin(), text.begin() + numCharsToDrop);
+            for (auto& value : values)
+            {
+                value.nameOffset -= numCharsToDrop;
+                value.valueOffset -= numCharsToDrop;
+            }
+        }
+    }
+    
+private:
+    std::atomic_flag _lock = ATOMIC_FLAG_INIT;
+    Buffers _producerBuffers;
+    Buffers _consumerBuffers;
+    std::unordered_map<const PlotWindow*, std::unordered_set<ImGuiID>> _groupsSentByThisThread;
+    std::unordered_map<const PlotWindow*, std::unordered_map<ImGuiID, size_t>> _stagedSampleIndexPerGroup;
+};
+
+struct StagingRegistry
+{
+    struct ValueToSet
+    {
+        uint64_t sequence;
+        ValueListWindow* window;
+        const char* name;
+        const char* value;
+    };
+    
+    std::mutex lock;
+    std::vector<std::shared_ptr<ThreadStaging>> threads;
+    
+    // Only used by the ImGui thread, kept to avoid reallocations.
+    struct
+    {
+        std::vector<std::shared_ptr<ThreadStaging>> threads;
+        std::vector<ThreadStaging::PlotSample> plotSamples;
+        std::vector<ValueToSet> values;
+    } cache;
+};
+
+static StagingRegistry g_StagingRegistry;
+
+static void FlushStagedValues();
+
+ThreadStaging& ThreadStaging::current()
+{
+    static std::once_flag flushCallbackRegistered;
+    std::call_once(flushCallbackRegistered, []() {
+        SetPerFrameCallback("CVLog::FlushStagedValues", FlushStagedValues);
+        
+        AddMenuBarCallback("CVLog::DroppedStagedValues", []() {
+            const StagingStats stats = GetStagingStats();
+            if (stats.numDroppedPlotSamples + stats.numDroppedValues == 0)
+                return;
+            ImGui::TextColored(ImVec4(1,0.4,0.4,1), "%llu dropped samples", (unsigned long long)(stats.numDroppedPlotSamples + stats.numDroppedValues));
+            if (ImGui::IsItemHovered())
+                ImGui::SetTooltip("%llu plot samples and %llu values.\nThe ImGui thread could not keep up, see SetStagingLimits.",
+                                  (unsigned long long)stats.numDroppedPlotSamples,
+                                  (unsigned long long)stats.numDroppedValues);
+        });
+        
+        AddDiagnosticsCallback("Staging", []() {
+            const StagingStats stats = GetStagingStats();
+            size_t numThreads = 0;
+            {
+                std::lock_guard<std::mutex> _ (g_StagingRegistry.lock);
+                numThreads = g_StagingRegistry.threads.size();
+            }
+            ImGui::Text("Producer threads: %zu", numThreads);
+            ImGui::Text("Dropped: %llu plot samples, %llu values",
+                        (unsigned long long)stats.numDroppedPlotSamples,
+                        (unsigned long long)stats.numDroppedValues);
+            ImGui::Text("Contended locks: %llu, total wait %.3f ms",
+                        (unsigned long long)stats.numContendedLocks,
+                        stats.totalLockWaitNs / 1e6);
+        });
+    });
+    
+    thread_local std::shared_ptr<ThreadStaging> staging;
+    if (!staging)
+    {
+        staging = std::make_shared<ThreadStaging>();
+        std::lock_guard<std::mutex> _ (g_StagingRegistry.lock);
+        g_StagingRegistry.threads.push_back(staging);
+    }
+    return *staging;
+}
+
+void SetStagingLimits(const QueueLimits& limits)
+{
+    g_StagingLimits.capacity.store(limits.capacity, std::memory_order_relaxed);
+    g_StagingLimits.policy.store(limits.policy, std::memory_order_relaxed);
+    g_StagingLimits.blockTimeoutNs.store(int64_t(limits.blockTimeoutInSeconds * 1e9), std::memory_order_relaxed);
+}
+
+StagingStats GetStagingStats()
+{
+    StagingStats stats;
+    stats.numDroppedPlotSamples = g_StagingLimits.numDroppedPlotSamples.load(std::memory_order_relaxed);
+    stats.numDroppedValues = g_StagingLimits.numDroppedValues.load(std::memory_order_relaxed);
+    stats.numContendedLocks = g_StagingLimits.numContendedLocks.load(std::memory_order_relaxed);
+    stats.totalLockWaitNs = g_StagingLimits.totalLockWaitNs.load(std::memory_order_relaxed);
+    return stats;
+}
+
+#pragma mark - Plot
+
+class PlotWindow : public Window
+{
+public:
+    void Clear() override
+    {
+        // Keep the name and style of the groups, they won't be sent again.
+        for (auto& it : _groupData)
+        {
+            it.second.xData.clear();
+            it.second.yData.clear();
+        }
+        _cacheOfDataToAppend.clear();
+        _previousLimits = {};
+        _autoFitEnabled = true;
+    }
+    
+    void AddPlotValue(const char* groupName,
+                      float yValue,
+                      float xValue,
+                      const char* style)
+    {
+        AddPlotValue(HashedName(groupName, ImHashStr(groupName)), yValue, xValue, style);
+    }
+    
+    void AddPlotValue(const HashedName& groupName,
+                      float yValue,
+                      float xValue,
+                      const char* style)
+    {
+        // Don't update it if it's not visible or too frequent to save on CPU time.
+        if (!acceptsUpdate())
+            return;
+        
+        auto& staging = ThreadStaging::current();
+        
+        // Only the first sample of a group sent by this thread needs the lock.
+        if (staging.isNewGroup(this, groupName.id))
+        {
+            GroupToAdd group;
+            group.id = groupName.id;
+            group.name = groupName.name;
+            group.style = style ? style : "";
+            auto lock = lockMeasuringWait(concurrent.lock);
+            concurrent.addedGroupsSinceLastFrame.push_back(group);
+        }
+        
+        staging.addPlotSample(this, groupName.id, xValue, yValue, keepsLatestUpdateOnly());
     }
     
-    void AddPlotValue(const char* groupName,
-                      float yValue,
-                      float xValue,
-                      const char* style)
+    void AddPlotValues(const HashedName& groupName,
+                       const double* yValues,
+                       const double* xValues,
+                       int count,
+                       const char* style)
     {
-        // Don't update it if it's not visible to save on CPU time.
-        if (!isVisible())
+        if (count <= 0 || !acceptsUpdate())
             return;
         
-        ImGuiID groupId = ImHashStr(groupName);
-        std::lock_guard<std::mutex> _ (concurrent.lock);
-        concurrent.dataSinceLastFrame.push_back({groupId,xValue,yValue});
-        if (!concurrent.existingGroups.GetBool(groupId))
+        auto& staging = ThreadStaging::current();
+        if (staging.isNewGroup(this, groupName.id))
         {
             GroupToAdd group;
-            group.name = groupName;
+            group.id = groupName.id;
+            group.name = groupName.name;
             group.style = style ? style : "";
+            auto lock = lockMeasuringWait(concurrent.lock);
             concurrent.addedGroupsSinceLastFrame.push_back(group);
         }
+        
+        staging.addPlotSamples(this, groupName.id, yValues, xValues, count, keepsLatestUpdateOnly());
     }
-            
-    void Render() override
+    
+    void AddPlotValues(const HashedName* groupNames,
+                       const double* yValues,
+                       int count,
+                       float xValue)
     {
+        if (count <= 0 || !acceptsUpdate())
+            return;
+        
+        auto& staging = ThreadStaging::current();
+        
+        // Announce all the new groups of the batch with a single lock.
+        std::vector<GroupToAdd> newGroups;
+        for (int i = 0; i < count; ++i)
         {
-            std::lock_guard<std::mutex> _ (concurrent.lock);
-            _cacheOfDataToAppend.swap (concurrent.dataSinceLastFrame);
-            for (const auto& group : concurrent.addedGroupsSinceLastFrame)
-            {
-                ImGuiID groupId = ImHashStr(group.name.c_str());
-                _groupData[groupId].name = group.name;
-                if (!group.style.empty())
-                {
-                    parseAndFillStyle (group.style, _groupData[groupId]);
-                }
-                concurrent.existingGroups.SetBool(groupId, true);
-            }
+            if (!staging.isNewGroup(this, groupNames[i].id))
+                continue;
+            GroupToAdd group;
+            group.id = groupNames[i].id;
+            group.name = groupNames[i].name;
+            newGroups.push_back(std::move(group));
         }
         
-        for (const auto& it : _cacheOfDataToAppend)
+        if (!newGroups.empty())
         {
-            auto& groupData = _groupData[it.group];
-            groupData.xData.push_back(it.xValue);
-            groupData.yData.push_back(it.yValue);
-            
-            if (groupData.xData.size() == 1)
-            {
-                groupData.xMin = groupData.xMax = it.xValue;
-                groupData.yMin = groupData.yMax = it.yValue;
-            }
-            else
-            {
-                groupData.xMin = std::min(groupData.xMin, it.xValue);
-                groupData.xMax = std::max(groupData.xMax, it.xValue);
-                groupData.yMin = std::min(groupData.yMin, it.yValue);
-                groupData.yMax = std::max(groupData.yMax, it.yValue);
-            }
-            
-            _dataBounds.xMin = std::min(_dataBounds.xMin, groupData.xMin);
-            _dataBounds.xMax = std::max(_dataBounds.xMax, groupData.xMax);
-            _dataBounds.yMin = std::min(_dataBounds.yMin, groupData.yMin);
-            _dataBounds.yMax = std::max(_dataBounds.yMax, groupData.yMax);
+            auto lock = lockMeasuringWait(concurrent.lock);
+            auto& addedGroups = concurrent.addedGroupsSinceLastFrame;
+            addedGroups.insert(addedGroups.end(), std::make_move_iterator(newGroups.begin()), std::make_move_iterator(newGroups.end()));
         }
-        _cacheOfDataToAppend.clear();
         
+        staging.addPlotSamples(this, groupNames, yValues, count, xValue, keepsLatestUpdateOnly());
+    }
+    
+    // ImGui thread only, called by FlushStagedValues.
+    void AppendStagedSamples(const ThreadStaging::PlotSample* samples, size_t count)
+    {
+        const size_t first = _cacheOfDataToAppend.size();
+        _cacheOfDataToAppend.resize(first + count);
+        for (size_t i = 0; i < count; ++i)
+            _cacheOfDataToAppend[first + i] = {samples[i].group, samples[i].xValue, samples[i].yValue};
+    }
+            
+    void Render() override
+    {
+        ingestNewData();
+        RenderStale();
+    }
+    
+    // Draws the data received until the last Render, the new samples wait.
+    void RenderStale() override
+    {
         if (_groupData.empty())
             return;
                 
@@ -466,11 +2179,77 @@ private:
     
     struct GroupToAdd
     {
+        ImGuiID id;
         std::string name;
         std::string style;
     };
     
 private:
+    void ingestNewData()
+    {
+        {
+            std::lock_guard<std::mutex> _ (concurrent.lock);
+            for (const auto& group : concurrent.addedGroupsSinceLastFrame)
+            {
+                _groupData[group.id].name = group.name;
+                if (!group.style.empty())
+                {
+                    parseAndFillStyle (group.style, _groupData[group.id]);
+                }
+            }
+            concurrent.addedGroupsSinceLastFrame.clear();
+        }
+        
+        reportSamplesIngested((int)_cacheOfDataToAppend.size());
+        
+        // Only the last sample of each group, the other ones get skipped below.
+        const bool keepLatestOnly = updatePolicy().keepLatestOnly;
+        if (keepLatestOnly)
+        {
+            _lastSampleIndexPerGroup.Clear();
+            for (int i = 0; i < (int)_cacheOfDataToAppend.size(); ++i)
+                _lastSampleIndexPerGroup.SetInt(_cacheOfDataToAppend[i].group, i);
+        }
+        
+        // Batches usually come in runs of the same group, skip the lookup for those.
+        GroupData* lastGroupData = nullptr;
+        ImGuiID lastGroup = 0;
+        for (int i = 0; i < (int)_cacheOfDataToAppend.size(); ++i)
+        {
+            const auto& it = _cacheOfDataToAppend[i];
+            if (keepLatestOnly && _lastSampleIndexPerGroup.GetInt(it.group) != i)
+                continue;
+            
+            if (!lastGroupData || lastGroup != it.group)
+            {
+                lastGroupData = &_groupData[it.group];
+                lastGroup = it.group;
+            }
+            auto& groupData = *lastGroupData;
+            groupData.xData.push_back(it.xValue);
+            groupData.yData.push_back(it.yValue);
+            
+            if (groupData.xData.size() == 1)
+            {
+                groupData.xMin = groupData.xMax = it.xValue;
+                groupData.yMin = groupData.yMax = it.yValue;
+            }
+            else
+            {
+                groupData.xMin = std::min(groupData.xMin, it.xValue);
+                groupData.xMax = std::max(groupData.xMax, it.xValue);
+                groupData.yMin = std::min(groupData.yMin, it.yValue);
+                groupData.yMax = std::max(groupData.yMax, it.yValue);
+            }
+            
+            _dataBounds.xMin = std::min(_dataBounds.xMin, groupData.xMin);
+            _dataBounds.xMax = std::max(_dataBounds.xMax, groupData.xMax);
+            _dataBounds.yMin = std::min(_dataBounds.yMin, groupData.yMin);
+            _dataBounds.yMax = std::max(_dataBounds.yMax, groupData.yMax);
+        }
+        _cacheOfDataToAppend.clear();
+    }
+    
     void parseAndFillStyle(const std::string& style, GroupData& group)
     {
         IM_ASSERT (style[0] == '#'); // only support format is #RRGGBB in hexidecimal, e.g. #ff000000 for red.
@@ -489,12 +2268,12 @@ private:
 private:
     std::unordered_map<ImGuiID,GroupData> _groupData;
     std::vector<DataToAppend> _cacheOfDataToAppend;
+    ImGuiStorage _lastSampleIndexPerGroup; // for UpdatePolicy::keepLatestOnly.
         
+    // The samples themselves go through ThreadStaging.
     struct {
         std::mutex lock;
-        std::vector<DataToAppend> dataSinceLastFrame;
         std::vector<GroupToAdd> addedGroupsSinceLastFrame;
-        ImGuiStorage existingGroups;
     } concurrent;
     
     struct {
@@ -513,6 +2292,17 @@ void AddPlotValue(const char* windowName,
                   double yValue,
                   double xValue,
                   const char* style)
+{
+    AddPlotValue(HashedName(windowName, ImHashStr(windowName)),
+                 HashedName(groupName, ImHashStr(groupName)),
+                 yValue, xValue, style);
+}
+
+void AddPlotValue(const HashedName& windowName,
+                  const HashedName& groupName,
+                  double yValue,
+                  double xValue,
+                  const char* style)
 {
     PlotWindow* plotWindow = FindWindow<PlotWindow> (windowName);
     
@@ -525,16 +2315,174 @@ void AddPlotValue(const char* windowName,
     
     // Need to create it, enqueue that in the list of tasks for the next frame;
     {
-        std::string windowNameCopy = windowName;
-        std::string groupNameCopy = groupName;
-        std::string styleCopy = style ? style : "";
-        RunOnceInImGuiThread([windowNameCopy,groupNameCopy,xValue,yValue,styleCopy](){
-            PlotWindow* plotWindow = FindOrCreateWindow<PlotWindow>(windowNameCopy.c_str());
-            plotWindow->AddPlotValue(groupNameCopy.c_str(), yValue, xValue, styleCopy.empty() ? nullptr : styleCopy.c_str());
-        });
+        auto storage = TaskStorage::acquire();
+        const char* windowNameCopy = storage.copyString(windowName.name);
+        const char* groupNameCopy = storage.copyString(groupName.name);
+        const char* styleCopy = storage.copyString(style);
+        RunOnceInImGuiThread(Task(std::move(storage), [windowNameCopy,groupNameCopy,xValue,yValue,styleCopy](){
+            PlotWindow* plotWindow = FindOrCreateWindow<PlotWindow>(windowNameCopy);
+            plotWindow->AddPlotValue(groupNameCopy, yValue, xValue, styleCopy);
+        }));
+    }
+}
+
+PlotHandle GetPlot(const char* windowName)
+{
+    return GetWindowHandle<PlotWindow>(windowName);
+}
+
+void AddPlotValue(const PlotHandle& window,
+                  const char* groupName,
+                  double yValue,
+                  double xValue,
+                  const char* style)
+{
+    AddPlotValue(window, HashedName(groupName, ImHashStr(groupName)), yValue, xValue, style);
+}
+
+void AddPlotValue(const PlotHandle& window,
+                  const HashedName& groupName,
+                  double yValue,
+                  double xValue,
+                  const char* style)
+{
+    PlotWindow* plotWindow = window.window();
+    
+    // Not created yet, go through the slow path.
+    if (!plotWindow)
+    {
+        IM_ASSERT (window); // use GetImage/GetPlot/GetValueList to get a valid handle.
+        AddPlotValue(HashedName(window.name(), ImHashStr(window.name())), groupName, yValue, xValue, style);
+        return;
+    }
+    
+    plotWindow->AddPlotValue(groupName, yValue, xValue, style);
+}
+
+void AddPlotValues(const char* windowName,
+                   const char* groupName,
+                   const double* yValues,
+                   const double* xValues,
+                   int count,
+                   const char* style)
+{
+    PlotWindow* plotWindow = FindWindow<PlotWindow> (windowName);
+    if (plotWindow)
+    {
+        plotWindow->AddPlotValues(HashedName(groupName, ImHashStr(groupName)), yValues, xValues, count, style);
+        return;
+    }
+    
+    // Need to create it, enqueue that in the list of tasks for the next frame;
+    {
+        auto storage = TaskStorage::acquire();
+        const char* windowNameCopy = storage.copyString(windowName);
+        const char* groupNameCopy = storage.copyString(groupName);
+        const char* styleCopy = storage.copyString(style);
+        const double* yValuesCopy = storage.copyArray(yValues, count);
+        const double* xValuesCopy = storage.copyArray(xValues, count);
+        RunOnceInImGuiThread(Task(std::move(storage), [=](){
+            PlotWindow* plotWindow = FindOrCreateWindow<PlotWindow>(windowNameCopy);
+            plotWindow->AddPlotValues(HashedName(groupNameCopy, ImHashStr(groupNameCopy)), yValuesCopy, xValuesCopy, count, styleCopy);
+        }));
+    }
+}
+
+void AddPlotValues(const PlotHandle& window,
+                   const char* groupName,
+                   const double* yValues,
+                   const double* xValues,
+                   int count,
+                   const char* style)
+{
+    AddPlotValues(window, HashedName(groupName, ImHashStr(groupName)), yValues, xValues, count, style);
+}
+
+void AddPlotValues(const PlotHandle& window,
+                   const HashedName& groupName,
+                   const double* yValues,
+                   const double* xValues,
+                   int count,
+                   const char* style)
+{
+    PlotWindow* plotWindow = window.window();
+    
+    // Not created yet, go through the slow path.
+    if (!plotWindow)
+    {
+        IM_ASSERT (window); // use GetImage/GetPlot/GetValueList to get a valid handle.
+        AddPlotValues(window.name(), groupName.name, yValues, xValues, count, style);
+        return;
+    }
+    
+    plotWindow->AddPlotValues(groupName, yValues, xValues, count, style);
+}
+
+void AddPlotValues(const char* windowName,
+                   const char* const* groupNames,
+                   const double* yValues,
+                   int count,
+                   double xValue)
+{
+    PlotWindow* plotWindow = FindWindow<PlotWindow> (windowName);
+    
+    // The window exists, just update the data.
+    if (plotWindow)
+    {
+        thread_local std::vector<HashedName> hashedNames;
+        hashedNames.clear();
+        for (int i = 0; i < count; ++i)
+            hashedNames.push_back(HashedName(groupNames[i], ImHashStr(groupNames[i])));
+        plotWindow->AddPlotValues(hashedNames.data(), yValues, count, xValue);
+        return;
+    }
+    
+    // Need to create it, enqueue that in the list of tasks for the next frame;
+    {
+        auto storage = TaskStorage::acquire();
+        const char* windowNameCopy = storage.copyString(windowName);
+        HashedName* groupNamesCopy = static_cast<HashedName*>(storage.allocate(sizeof(HashedName)*count, alignof(HashedName)));
+        for (int i = 0; i < count; ++i)
+        {
+            const char* groupNameCopy = storage.copyString(groupNames[i]);
+            new (groupNamesCopy + i) HashedName(groupNameCopy, ImHashStr(groupNameCopy));
+        }
+        const double* yValuesCopy = storage.copyArray(yValues, count);
+        RunOnceInImGuiThread(Task(std::move(storage), [=](){
+            PlotWindow* plotWindow = FindOrCreateWindow<PlotWindow>(windowNameCopy);
+            plotWindow->AddPlotValues(groupNamesCopy, yValuesCopy, count, xValue);
+        }));
     }
 }
 
+void AddPlotValues(const PlotHandle& window,
+                   const HashedName* groupNames,
+                   const double* yValues,
+                   int count,
+                   double xValue)
+{
+    PlotWindow* plotWindow = window.window();
+    
+    // Not created yet, go through the slow path.
+    if (!plotWindow)
+    {
+        IM_ASSERT (window); // use GetImage/GetPlot/GetValueList to get a valid handle.
+        auto storage = TaskStorage::acquire();
+        const char* windowNameCopy = storage.copyString(window.name());
+        HashedName* groupNamesCopy = static_cast<HashedName*>(storage.allocate(sizeof(HashedName)*count, alignof(HashedName)));
+        for (int i = 0; i < count; ++i)
+            new (groupNamesCopy + i) HashedName(storage.copyString(groupNames[i].name), groupNames[i].id);
+        const double* yValuesCopy = storage.copyArray(yValues, count);
+        RunOnceInImGuiThread(Task(std::move(storage), [=](){
+            PlotWindow* plotWindow = FindOrCreateWindow<PlotWindow>(windowNameCopy);
+            plotWindow->AddPlotValues(groupNamesCopy, yValuesCopy, count, xValue);
+        }));
+        return;
+    }
+    
+    plotWindow->AddPlotValues(groupNames, yValues, count, xValue);
+}
+
 #pragma mark - String values
 
 class ValueListWindow : public Window
@@ -542,14 +2490,31 @@ class ValueListWindow : public Window
 public:
     void Clear() override
     {
-        std::lock_guard<std::mutex> _ (concurrent.lock);
         _values.clear();
     }
     
+    // Not conditioned on the visibility, each value would stay stale until sent again.
     void AddValue(const char* name, const char* value)
     {
-        std::lock_guard<std::mutex> _ (concurrent.lock);
-        concurrent.valuesToUpdate.push_back({name, value});
+        if (!passesUpdatePolicy())
+            return;
+        
+        ThreadStaging::current().addValue(this, name, value);
+    }
+    
+    void AddValues(const char* const* names, const char* const* values, int count)
+    {
+        if (count <= 0 || !passesUpdatePolicy())
+            return;
+        
+        ThreadStaging::current().addValues(this, names, values, count);
+    }
+    
+    // ImGui thread only, called by FlushStagedValues.
+    void SetStagedValue(const char* name, const char* value)
+    {
+        reportSamplesIngested(1);
+        _values[name] = value;
     }
     
     bool Begin(bool* closed) override
@@ -559,16 +2524,6 @@ public:
     
     void Render() override
     {
-        {
-            std::lock_guard<std::mutex> _ (concurrent.lock);
-            _cacheOfValuesToUpdate.swap (concurrent.valuesToUpdate);
-        }
-        
-        for (const auto& it : _cacheOfValuesToUpdate)
-            _values[it.valueName] = it.value;
-        
-        _cacheOfValuesToUpdate.clear();
-        
         Begin(nullptr);
         
         for (const auto& it : _values)
@@ -580,27 +2535,20 @@ public:
     }
     
 private:
-    struct ValueToUpdate
-    {
-        std::string valueName;
-        std::string value;
-    };
-    
-private:
-    struct {
-        std::mutex lock;
-        std::vector<ValueToUpdate> valuesToUpdate;
-        ImGuiStorage existingGroups;
-    } concurrent;
-    
-    std::vector<ValueToUpdate> _cacheOfValuesToUpdate;
-    
+    // Updated by FlushStagedValues.
     std::unordered_map<std::string, std::string> _values;
 };
 
 void AddValue(const char* windowName,
               const char* name,
               const char* value)
+{
+    AddValue(HashedName(windowName, ImHashStr(windowName)), name, value);
+}
+
+void AddValue(const HashedName& windowName,
+              const char* name,
+              const char* value)
 {
     ValueListWindow* valuesWindow = FindWindow<ValueListWindow> (windowName);
     
@@ -613,16 +2561,150 @@ void AddValue(const char* windowName,
     
     // Need to create it, enqueue that in the list of tasks for the next frame;
     {
-        std::string windowNameCopy = windowName;
-        std::string nameCopy = name;
-        std::string valueCopy = value;
-        RunOnceInImGuiThread([windowNameCopy,nameCopy,valueCopy](){
-            ValueListWindow* valuesWindow = FindOrCreateWindow<ValueListWindow>(windowNameCopy.c_str());
-            valuesWindow->AddValue(nameCopy.c_str(), valueCopy.c_str());
-        });
+        auto storage = TaskStorage::acquire();
+        const char* windowNameCopy = storage.copyString(windowName.name);
+        const char* nameCopy = storage.copyString(name);
+        const char* valueCopy = storage.copyString(value);
+        RunOnceInImGuiThread(Task(std::move(storage), [windowNameCopy,nameCopy,valueCopy](){
+            ValueListWindow* valuesWindow = FindOrCreateWindow<ValueListWindow>(windowNameCopy);
+            valuesWindow->AddValue(nameCopy, valueCopy);
+        }));
+    }
+}
+
+ValueListHandle GetValueList(const char* windowName)
+{
+    return GetWindowHandle<ValueListWindow>(windowName);
+}
+
+void AddValue(const ValueListHandle& window,
+              const char* name,
+              const char* value)
+{
+    ValueListWindow* valuesWindow = window.window();
+    
+    // Not created yet, go through the slow path.
+    if (!valuesWindow)
+    {
+        IM_ASSERT (window); // use GetImage/GetPlot/GetValueList to get a valid handle.
+        AddValue(window.name(), name, value);
+        return;
+    }
+    
+    valuesWindow->AddValue(name, value);
+}
+
+void AddValues(const char* windowName,
+               const char* const* names,
+               const char* const* values,
+               int count)
+{
+    ValueListWindow* valuesWindow = FindWindow<ValueListWindow> (windowName);
+    
+    // The window exists, just update the data.
+    if (valuesWindow)
+    {
+        valuesWindow->AddValues(names, values, count);
+        return;
+    }
+    
+    // Need to create it, enqueue that in the list of tasks for the next frame;
+    {
+        auto storage = TaskStorage::acquire();
+        const char* windowNameCopy = storage.copyString(windowName);
+        const char** namesCopy = static_cast<const char**>(storage.allocate(sizeof(const char*)*count, alignof(const char*)));
+        const char** valuesCopy = static_cast<const char**>(storage.allocate(sizeof(const char*)*count, alignof(const char*)));
+        for (int i = 0; i < count; ++i)
+        {
+            namesCopy[i] = storage.copyString(names[i]);
+            valuesCopy[i] = storage.copyString(values[i]);
+        }
+        RunOnceInImGuiThread(Task(std::move(storage), [=](){
+            ValueListWindow* valuesWindow = FindOrCreateWindow<ValueListWindow>(windowNameCopy);
+            valuesWindow->AddValues(namesCopy, valuesCopy, count);
+        }));
+    }
+}
+
+void AddValues(const ValueListHandle& window,
+               const char* const* names,
+               const char* const* values,
+               int count)
+{
+    ValueListWindow* valuesWindow = window.window();
+    
+    // Not created yet, go through the slow path.
+    if (!valuesWindow)
+    {
+        IM_ASSERT (window); // use GetImage/GetPlot/GetValueList to get a valid handle.
+        AddValues(window.name(), names, values, count);
+        return;
     }
+    
+    valuesWindow->AddValues(names, values, count);
 }
 
+#pragma mark - Staging flush
+
+// Runs once per frame, before the windows get rendered.
+static void FlushStagedValues()
+{
+    auto& cache = g_StagingRegistry.cache;
+    {
+        std::lock_guard<std::mutex> _ (g_StagingRegistry.lock);
+        cache.threads = g_StagingRegistry.threads;
+    }
+    
+    int numThreadsWithPlotSamples = 0;
+    int numThreadsWithValues = 0;
+    for (const auto& staging : cache.threads)
+    {
+        auto& buffers = staging->takeBuffers();
+        numThreadsWithPlotSamples += !buffers.plotSamples.empty();
+        numThreadsWithValues += !buffers.values.empty();
+        
+        cache.plotSamples.insert(cache.plotSamples.end(), buffers.plotSamples.begin(), buffers.plotSamples.end());
+        for (const auto& value : buffers.values)
+        {
+            cache.values.push_back({value.sequence, value.window,
+                                    buffers.text.data() + value.nameOffset,
+                                    buffers.text.data() + value.valueOffset});
+        }
+    }
+    
+    // Each thread already sent its values in order, only merge if several did.
+    auto bySequence = [](const auto& lhs, const auto& rhs) { return lhs.sequence < rhs.sequence; };
+    if (numThreadsWithPlotSamples > 1)
+        std::stable_sort(cache.plotSamples.begin(), cache.plotSamples.end(), bySequence);
+    if (numThreadsWithValues > 1)
+        std::stable_sort(cache.values.begin(), cache.values.end(), bySequence);
+    
+    // Hand over runs of samples for the same window at once.
+    for (size_t first = 0, last = 0; first < cache.plotSamples.size(); first = last)
+    {
+        PlotWindow* window = cache.plotSamples[first].window;
+        while (last < cache.plotSamples.size() && cache.plotSamples[last].window == window)
+            ++last;
+        window->AppendStagedSamples(cache.plotSamples.data() + first, last - first);
+    }
+    
+    for (const auto& value : cache.values)
+        value.window->SetStagedValue(value.name, value.value);
+    
+    cache.plotSamples.clear();
+    cache.values.clear();
+    
+    // Forget the threads that exited once their last values got flushed.
+    {
+        std::lock_guard<std::mutex> _ (g_StagingRegistry.lock);
+        auto& threads = g_StagingRegistry.threads;
+        threads.erase(std::remove_if(threads.begin(), threads.end(), [](const std::shared_ptr<ThreadStaging>& staging) {
+            // Only the registry and the cache are left, nobody can send more values.
+            return staging.use_count() == 2 && staging->empty();
+        }), threads.end());
+    }
+    cache.threads.clear();
+}
 
 } // CVLog
 } // ImGui
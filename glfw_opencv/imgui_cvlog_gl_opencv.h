@@ -4,6 +4,7 @@
 
 #include "imgui_cvlog.h"
 
+#include <functional>
 #include <memory>
 #include <vector>
 
@@ -37,15 +38,153 @@ public:
     
     bool exitRequested() const;
     
+    /// In idle mode the loop sleeps until there is some input or new data
+    /// (see ImGui::CVLog::RequestRedraw) instead of rendering at the vsync rate.
+    /// It still wakes up every maxIdleSeconds, and when a window provider is due.
+    /// Per-frame callbacks only run when a frame gets rendered. Disabled by default.
+    void setIdleMode (bool enabled, double maxIdleSeconds = 1.0);
+    
+    /// Upper bound on the frame rate on top of vsync, 0 for no limit (the default).
+    void setMaxFPS (double maxFPS);
+    
 private:
     struct Impl;
     friend struct Impl;
     std::unique_ptr<Impl> impl;
 };
+
+/// Where ImageWindow sends its pixels. The default one uploads to OpenGL textures.
+/// Called from the ImGui thread only.
+class TextureBackend
+{
+public:
+    virtual ~TextureBackend () {}
     
+    /// Returns the identifier to give to ImGui::Image. Textures are never deleted
+    /// individually, they live as long as the rendering context.
+    virtual ImTextureID createTexture () = 0;
+    
+    /// Replaces the content of the texture, image can be any of the types supported
+    /// by UpdateImage and is not necessarily continuous.
+    virtual void uploadImage (ImTextureID texture, const cv::Mat& image) = 0;
+    
+    /// True while the last uploadImage has not reached the texture yet, e.g. when it
+    /// goes through a pixel buffer. The texture keeps its previous content meanwhile.
+    virtual bool isUploadPending (ImTextureID /*texture*/) const { return false; }
+};
+
+/// Image windows created afterwards use this backend, existing ones keep theirs.
+/// Pass nullptr to restore the OpenGL one. ImGui thread only.
+void SetTextureBackend (const std::shared_ptr<TextureBackend>& backend);
+
+struct TextureUploadStats
+{
+    uint64_t numTexturesCreated = 0;
+    uint64_t numUploads = 0;
+    uint64_t numBytesUploaded = 0;
+    int lastUploadWidth = 0;
+    int lastUploadHeight = 0;
+    int lastUploadType = -1;
+};
+
+/// Does not touch any GPU, only records the uploads.
+class NullTextureBackend : public TextureBackend
+{
+public:
+    ImTextureID createTexture () override;
+    void uploadImage (ImTextureID texture, const cv::Mat& image) override;
+    
+    const TextureUploadStats& stats () const { return _stats; }
+    
+private:
+    TextureUploadStats _stats;
+};
+
+/// Runs the same ingestion and rendering pipeline as OpenCVGLWindow without any
+/// window nor GPU, e.g. for benchmarks and continuous integration. Modeled after
+/// imgui/examples/example_null: the draw lists get generated but are never
+/// rendered, and the images go to a NullTextureBackend.
+class HeadlessWindow
+{
+public:
+    HeadlessWindow ();
+    ~HeadlessWindow ();
+    
+    /// Creates the ImGui and ImPlot contexts and installs the NullTextureBackend.
+    void initializeContexts (int displayWidth = 1280, int displayHeight = 720);
+    
+    /// Shutdown the created contexts.
+    void shutDown ();
+    
+    /// Generates one frame. Uses the elapsed time since the previous one when deltaTime is 0.
+    void runOnce (float deltaTime = 0.f);
+    
+    const TextureUploadStats& textureUploadStats () const;
+    
+private:
+    struct Impl;
+    std::unique_ptr<Impl> impl;
+};
+    
+class ImageWindow;
+class PlotWindow;
+class ValueListWindow;
+
+// Handles to skip the window lookup on each call, see WindowHandle.
+using ImageHandle = WindowHandle<ImageWindow>;
+using PlotHandle = WindowHandle<PlotWindow>;
+using ValueListHandle = WindowHandle<ValueListWindow>;
+    
+/// Only CV_8UC1/3/4 and CV_32FC1/3/4 images, the other types get rejected.
 void UpdateImage(const char* windowName,
                  const cv::Mat& image);
 
+void UpdateImage(const HashedName& windowName,
+                 const cv::Mat& image);
+
+ImageHandle GetImage(const char* windowName);
+void UpdateImage(const ImageHandle& window,
+                 const cv::Mat& image);
+
+/// Large images get downscaled by a power of two with a box filter on a worker
+/// thread before the upload, keeping a resolution at least as large as the
+/// displayed one. Enabled by default, disable it to always upload the full resolution.
+void SetImageDownscaling(bool enabled);
+
+/// For the images too large for a single texture, e.g. stitched panoramas. A worker
+/// thread builds a pyramid of 256x256 tiles, and only the tiles visible at the
+/// current zoom get uploaded. Mouse wheel to zoom, drag to pan, double-click to fit.
+/// Only CV_8UC1/3/4 and CV_32FC1/3/4 images, the other types are ignored.
+void UpdateTiledImage(const char* windowName,
+                      const cv::Mat& image);
+
+/// GPU memory shared by the tiles of all the tiled image windows, the least recently
+/// drawn tiles get replaced once it is reached. 256 MB by default. Lowering it
+/// does not release the textures that already exist.
+void SetTileMemoryBudget(size_t numBytes);
+
+/// Pull mode, see SetWindowProvider. The provider returns the image to show,
+/// or an empty one to keep the current image.
+void SetImageProvider(const char* windowName,
+                      const std::function<cv::Mat(void)>& provider,
+                      double refreshIntervalInSeconds = 0.0,
+                      bool runInWorkerThread = false);
+
+/// Bound the plot samples and values waiting in each producer thread for the
+/// next frame. 1M per thread by default, dropping the oldest ones. With
+/// QueuePolicy::Block the ImGui thread never waits, its own buffers can go over
+/// the capacity until they get flushed on the next frame.
+void SetStagingLimits(const QueueLimits& limits);
+
+struct StagingStats
+{
+    uint64_t numDroppedPlotSamples = 0;
+    uint64_t numDroppedValues = 0;
+    uint64_t numContendedLocks = 0; // the ImGui thread was taking the buffers.
+    uint64_t totalLockWaitNs = 0;
+};
+StagingStats GetStagingStats();
+
 // Plot
 
 void AddPlotValue(const char* windowName,
@@ -54,11 +193,96 @@ void AddPlotValue(const char* windowName,
                   double xValue,
                   const char* style = nullptr);
 
+// Use CVLOG_HASHED for the window and group names to skip the hashing.
+void AddPlotValue(const HashedName& windowName,
+                  const HashedName& groupName,
+                  double yValue,
+                  double xValue,
+                  const char* style = nullptr);
+
+PlotHandle GetPlot(const char* windowName);
+void AddPlotValue(const PlotHandle& window,
+                  const char* groupName,
+                  double yValue,
+                  double xValue,
+                  const char* style = nullptr);
+void AddPlotValue(const PlotHandle& window,
+                  const HashedName& groupName,
+                  double yValue,
+                  double xValue,
+                  const char* style = nullptr);
+
+// Plot batches, one window lookup and one lock for the whole batch.
+
+// Many samples of one group. xValues can be nullptr, the samples then get
+// their index in the batch (0 to count-1) as x.
+void AddPlotValues(const char* windowName,
+                   const char* groupName,
+                   const double* yValues,
+                   const double* xValues,
+                   int count,
+                   const char* style = nullptr);
+
+void AddPlotValues(const PlotHandle& window,
+                   const char* groupName,
+                   const double* yValues,
+                   const double* xValues,
+                   int count,
+                   const char* style = nullptr);
+void AddPlotValues(const PlotHandle& window,
+                   const HashedName& groupName,
+                   const double* yValues,
+                   const double* xValues,
+                   int count,
+                   const char* style = nullptr);
+
+// One sample for many groups, e.g. all the trackers of one iteration.
+void AddPlotValues(const char* windowName,
+                   const char* const* groupNames,
+                   const double* yValues,
+                   int count,
+                   double xValue);
+
+void AddPlotValues(const PlotHandle& window,
+                   const HashedName* groupNames,
+                   const double* yValues,
+                   int count,
+                   double xValue);
+
 // Strings
 
 void AddValue(const char* windowName,
               const char* name,
               const char* value);
 
+void AddValue(const HashedName& windowName,
+              const char* name,
+              const char* value);
+
+ValueListHandle GetValueList(const char* windowName);
+void AddValue(const ValueListHandle& window,
+              const char* name,
+              const char* value);
+
+// Batch version, one window lookup and one lock for all the values.
+void AddValues(const char* windowName,
+               const char* const* names,
+               const char* const* values,
+               int count);
+
+void AddValues(const ValueListHandle& window,
+               const char* const* names,
+               const char* const* values,
+               int count);
+
 } // CVLog
 } // ImGui
+
+// Compiled out when CVLOG_ENABLED is 0, see CVLOG in imgui_cvlog.h.
+#define CVLOG_UPDATE_IMAGE(...) CVLOG(ImGui::CVLog::UpdateImage(__VA_ARGS__))
+#define CVLOG_UPDATE_TILED_IMAGE(...) CVLOG(ImGui::CVLog::UpdateTiledImage(__VA_ARGS__))
+#define CVLOG_SET_IMAGE_PROVIDER(...) CVLOG(ImGui::CVLog::SetImageProvider(__VA_ARGS__))
+#define CVLOG_ADD_PLOT_VALUE(...) CVLOG(ImGui::CVLog::AddPlotValue(__VA_ARGS__))
+#define CVLOG_ADD_PLOT_VALUES(...) CVLOG(ImGui::CVLog::AddPlotValues(__VA_ARGS__))
+#define CVLOG_ADD_VALUE(...) CVLOG(ImGui::CVLog::AddValue(__VA_ARGS__))
+#define CVLOG_ADD_VALUES(...) CVLOG(ImGui::CVLog::AddValues(__VA_ARGS__))
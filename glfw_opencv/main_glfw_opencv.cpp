@@ -4,8 +4,8 @@
 #include "imgui.h"
 #include "implot.h"
 
-#include "imgui/examples/imgui_impl_osx.h"
-#include "imgui/examples/imgui_impl_opengl3.h"
+#include "imgui/backends/imgui_impl_osx.h"
+#include "imgui/backends/imgui_impl_opengl3.h"
 
 #include <opencv2/core.hpp>
 
@@ -15,6 +15,11 @@ void workerThread1()
 {
     ImGui::CVLog::SetWindowProperties("VGAImage", "Images", "Image that is VGA", 640, 480);
     
+    // Resolve the windows once to avoid looking them up for each value.
+    std::vector<ImGui::CVLog::PlotHandle> plots;
+    for (int k = 0; k < 10; ++k)
+        plots.push_back(ImGui::CVLog::GetPlot(("PlotN - " + std::to_string(k)).c_str()));
+    
     int i = 0;
     while (true)
     {
@@ -37,8 +42,8 @@ void workerThread1()
         
         for (int k = 0; k < 10; ++k)
         {
-            ImGui::CVLog::AddPlotValue(("PlotN - " + std::to_string(k)).c_str(), "Line 1", log(i+1+k), i, "#00ff00ff");
-            ImGui::CVLog::AddPlotValue(("PlotN - " + std::to_string(k)).c_str(), "Line 2", log(i+1+k)/2.f, i);
+            ImGui::CVLog::AddPlotValue(plots[k], "Line 1", log(i+1+k), i, "#00ff00ff");
+            ImGui::CVLog::AddPlotValue(plots[k], "Line 2", log(i+1+k)/2.f, i);
         }
         
         ++i;
@@ -77,8 +82,9 @@ void workerThread2()
             ImGui::CVLog::UpdateImage("SmallImage with a very long name that won't fit", image);
         }
         
-        ImGui::CVLog::AddPlotValue("Plot1", "Line 1", log(i*i + 1), i);
-        ImGui::CVLog::AddPlotValue("Plot1", "Line 2", log(i*i + 1) + 1, i);
+        // Hash the literal names at compile time.
+        ImGui::CVLog::AddPlotValue(CVLOG_HASHED("Plot1"), CVLOG_HASHED("Line 1"), log(i*i + 1), i);
+        ImGui::CVLog::AddPlotValue(CVLOG_HASHED("Plot1"), CVLOG_HASHED("Line 2"), log(i*i + 1) + 1, i);
         
         ImGui::CVLog::AddValue("ValueList",
                                "Thread2 Index",
@@ -5,7 +5,11 @@
 #include <imgui/imgui_internal.h>
 
 #include <map>
-#include <set>
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <atomic>
+#include <chrono>
 #include <string>
 #include <vector>
 #include <thread>
@@ -13,6 +17,7 @@
 #include <filesystem>
 #include <unordered_map>
 #include <mutex>
+#include <cstring>
 
 namespace fs = std::filesystem;
 
@@ -23,6 +28,59 @@ namespace CVLog
 
 class Window;
 
+// Last values of a per-frame measure, for the diagnostics window.
+struct RollingHistory
+{
+    static constexpr int size = 120;
+    
+    void add(float value)
+    {
+        values[offset] = value;
+        offset = (offset + 1) % size;
+    }
+    
+    float last() const { return values[(offset + size - 1) % size]; }
+    
+    float average() const
+    {
+        float sum = 0.f;
+        for (float value : values)
+            sum += value;
+        return sum / size;
+    }
+    
+    float max() const { return *std::max_element(values, values + size); }
+    
+    void plot(const char* label, const char* format) const
+    {
+        char overlay[64];
+        snprintf(overlay, sizeof(overlay), format, last(), average(), max());
+        ImGui::PlotLines(label, values, size, offset, overlay, 0.f, FLT_MAX, ImVec2(0, ImGui::GetFrameHeight()*2.f));
+    }
+    
+    float values[size] = {};
+    int offset = 0;
+};
+
+// Filled by the windows for the diagnostics window.
+struct WindowStats
+{
+    // ImGui thread only, reset each frame once added to the histories.
+    int numSamplesIngested = 0;
+    size_t numBytesUploaded = 0;
+    
+    // Producer threads, only updated when a lock was contended.
+    std::atomic<uint64_t> totalLockWaitNs { 0 };
+    uint64_t totalLockWaitNsAtLastFrame = 0;
+    
+    RollingHistory renderTimeMs;
+    RollingHistory samplesIngested;
+    RollingHistory kbUploaded;
+    RollingHistory lockWaitUs;
+};
+
+struct WindowCategory;
+
 class WindowData
 {
 public:
@@ -41,17 +99,30 @@ public:
     // Here we hackily rely on a special window settings to avoid having to write
     // our own settings handler and have persistent data.
     bool isVisible() const { return _isVisible; };
-    bool& isVisibleRef() { return _isVisible; };
+    // Also keeps the visible count of the category up to date.
+    void setVisible(bool visible);
     
     bool isDocked() const { return _isDocked; }
     bool& isDockedRef() { return _isDocked; }
+    
+    // Unlike isVisible, also false when the window is collapsed, in a hidden tab,
+    // fully covered by another window or off-screen. Updated by the ImGui thread
+    // each frame, producers read it to skip their work.
+    bool isEffectivelyVisible() const { return _isEffectivelyVisible.load(std::memory_order_relaxed); }
+    const std::atomic<bool>& isEffectivelyVisibleRef() const { return _isEffectivelyVisible; }
+    void setEffectivelyVisible(bool visible) { _isEffectivelyVisible.store(visible, std::memory_order_relaxed); }
 
 public:
     // Can be nullptr if no window was yet created, but properties were specified.
-    Window* window = nullptr;
+    // Published atomically since other threads look it up.
+    std::atomic<Window*> window { nullptr };
     
     std::string category = defaultCategoryName();
     
+    // Maintained by the WindowManager, ImGui thread only.
+    WindowCategory* categoryData = nullptr;
+    size_t indexInCategory = 0; // in categoryData->windows, for O(1) removal.
+    
     ImVec2 preferredContentSize = ImVec2(320,240);
 
     float extraWindowHeight() const
@@ -85,18 +156,154 @@ public:
         
     std::map<std::string, std::function<void(void)>> preRenderCallbacks;
     
+    // ImGui thread only, set once the window got rendered.
+    ImGuiWindow* imGuiWindow = nullptr;
+    
+    // ImGui thread only, see concurrentUpdateLimits for the producers.
+    UpdatePolicy updatePolicy;
+    
+    // Frame budget scheduling, ImGui thread only.
+    int priority = 0;
+    int numStaleFrames = 0;
+    bool refreshThisFrame = true;
+    float estimatedRenderTimeMs = 0.f; // of the full Render.
+    
+    WindowStats stats;
+    
+    // Written by the ImGui thread, used by the producers in Window::acceptsUpdate.
+    struct
+    {
+        std::atomic<int64_t> minUpdateIntervalNs { 0 };
+        std::atomic<int64_t> nextUpdateTimeNs { 0 };
+        std::atomic<int> keepEveryNth { 1 };
+        std::atomic<bool> keepLatestOnly { false };
+        std::atomic<uint32_t> numUpdatesReceived { 0 };
+    } concurrentUpdateLimits;
+    
 private:
     // Keeping everything to have good performance in Debug too.
     std::string _name;
     ImGuiID _id = 0; // == ImHashStr(name)
     bool _isVisible = true;
     bool _isDocked = false;
+    std::atomic<bool> _isEffectivelyVisible { true };
 };
 
 struct WindowCategory
 {
     std::string name;
     std::vector<WindowData*> windows;
+    int numVisible = 0; // kept up to date by WindowData::setVisible.
+};
+
+inline void WindowData::setVisible(bool visible)
+{
+    if (visible == _isVisible)
+        return;
+    
+    _isVisible = visible;
+    if (categoryData)
+        categoryData->numVisible += visible ? 1 : -1;
+}
+
+// Lookup of the windows by ID for any thread.
+//
+// Open addressing table where lookups never block nor retry. Windows are never
+// removed, so new entries get inserted in place: the ID is written first and
+// the data pointer published last, readers stop at the first null pointer.
+// Growing publishes a new snapshot atomically. The old ones are kept until
+// shutdown since a reader might still be looking at them, that's less than
+// the size of the current table as it doubles each time.
+class WindowIndex
+{
+public:
+    WindowIndex()
+    {
+        _current.store(new Table(64));
+    }
+    
+    ~WindowIndex()
+    {
+        delete _current.load();
+    }
+    
+    // Any thread.
+    WindowData* find(ImGuiID id) const
+    {
+        const Table* table = _current.load(std::memory_order_acquire);
+        WindowData* data = nullptr;
+        for (size_t i = id & table->mask;; i = (i + 1) & table->mask)
+        {
+            const Entry& entry = table->entries[i];
+            data = entry.data.load(std::memory_order_acquire);
+            if (data == nullptr || entry.id.load(std::memory_order_relaxed) == id)
+                break;
+        }
+        return data;
+    }
+    
+    // ImGui thread only.
+    void insert(ImGuiID id, WindowData* data)
+    {
+        Table* table = _current.load(std::memory_order_relaxed);
+        if ((table->size + 1) * 2 > table->capacity())
+        {
+            Table* newTable = new Table(table->capacity() * 2);
+            for (size_t i = 0; i < table->capacity(); ++i)
+            {
+                WindowData* existingData = table->entries[i].data.load(std::memory_order_relaxed);
+                if (existingData)
+                    insertInTable(*newTable, table->entries[i].id.load(std::memory_order_relaxed), existingData);
+            }
+            _current.store(newTable, std::memory_order_release);
+            _retiredTables.emplace_back(table);
+            table = newTable;
+        }
+        insertInTable(*table, id, data);
+    }
+    
+private:
+    struct Entry
+    {
+        std::atomic<ImGuiID> id { 0 };
+        std::atomic<WindowData*> data { nullptr };
+    };
+    
+    struct Table
+    {
+        Table(size_t capacity) : entries(new Entry[capacity]), mask(capacity - 1) {}
+        size_t capacity() const { return mask + 1; }
+        
+        std::unique_ptr<Entry[]> entries;
+        size_t mask = 0;
+        size_t size = 0;
+    };
+    
+    void insertInTable(Table& table, ImGuiID id, WindowData* data)
+    {
+        for (size_t i = id & table.mask;; i = (i + 1) & table.mask)
+        {
+            Entry& entry = table.entries[i];
+            WindowData* existingData = entry.data.load(std::memory_order_relaxed);
+            if (existingData == nullptr)
+            {
+                entry.id.store(id, std::memory_order_relaxed);
+                entry.data.store(data, std::memory_order_release);
+                ++table.size;
+                return;
+            }
+            
+            if (entry.id.load(std::memory_order_relaxed) == id)
+            {
+                entry.data.store(data, std::memory_order_release);
+                return;
+            }
+        }
+    }
+    
+private:
+    std::atomic<Table*> _current { nullptr };
+    std::vector<std::unique_ptr<Table>> _retiredTables;
 };
 
 class WindowManager
@@ -104,6 +311,9 @@ class WindowManager
 public:
     static constexpr int windowListWidth = 200;
     
+    // Below that the windows would be unusable, better leave the layout as is.
+    static constexpr float minTilingScale = 0.05f;
+    
 public:
     const std::vector<std::unique_ptr<WindowData>>& windowsData() const { return _windowsData; };
     
@@ -112,13 +322,32 @@ public:
         _menuBarCallbacks[name] = callback;
     }
     
+    void AddDiagnosticsCallback(const std::string& name, const std::function<void(void)>& callback)
+    {
+        _diagnostics.callbacks[name] = callback;
+    }
+    
+    void SetFrameBudget(float budgetMs, int maxStaleFrames)
+    {
+        _frameBudget.budgetMs = budgetMs;
+        _frameBudget.maxStaleFrames = std::max(maxStaleFrames, 0);
+    }
+    
+    // Called by CVLog::Render before rendering the windows.
+    void RecordTaskLoop(int numTasksDrained, float taskLoopTimeMs, float providersTimeMs)
+    {
+        _diagnostics.tasksDrained.add(numTasksDrained);
+        _diagnostics.taskLoopTimeMs.add(taskLoopTimeMs);
+        _diagnostics.providersTimeMs.add(providersTimeMs);
+    }
+    
     WindowData& AddWindow (const char* windowName, std::unique_ptr<Window> windowPtr)
     {
         Window* window = windowPtr.get();
         _windows.emplace_back(std::move(windowPtr));
         auto& data = FindOrCreateDataForWindow(windowName);
-        data.window = window;
         window->imGuiData = &data;
+        data.window.store(window, std::memory_order_release);
         
         auto& vp = *ImGui::GetMainViewport();
         
@@ -142,16 +371,10 @@ public:
         if (data.category == newCategory)
             return data;
         
-        auto& oldCat = findOrCreateCategory(data.category.c_str());
-        
-        auto oldCatIt = std::find_if(oldCat.windows.begin(), oldCat.windows.end(), [&](WindowData* p) {
-            return &data == p;
-        });
-        oldCat.windows.erase(oldCatIt);
+        removeFromCategory(findOrCreateCategory(data.category.c_str()), data);
         
         data.category = newCategory;
-        auto& newCat = findOrCreateCategory(newCategory);
-        newCat.windows.push_back (&data);
+        addToCategory(findOrCreateCategory(newCategory), data);
         return data;
     }
     
@@ -178,83 +401,105 @@ public:
         return createDataForWindow(windowName, WindowData::defaultCategoryName());
     }
     
+    // Shelf packing of the visible windows at the largest scale that fits,
+    // found by binary search. Never scales the windows up.
     void TileAndScaleVisibleWindows()
     {
-        auto& vp = *ImGui::GetMainViewport();
+        auto& windows = _cache.tiledWindows;
+        windows.clear();
+        for (const auto& winData : _windowsData)
+        {
+            // Don't reorganize docked windows.
+            if (winData->window.load(std::memory_order_relaxed) && winData->isVisible() && !winData->isDocked())
+                windows.push_back(winData.get());
+        }
         
-        auto isWindowHeightSmaller = [](const Window* w1, const Window* w2) {
-            if (w1->imGuiData->preferredContentSize.y < w2->imGuiData->preferredContentSize.y)
-                return true;
-            if (w1->imGuiData->preferredContentSize.y > w2->imGuiData->preferredContentSize.y)
-                return false;
-            if (w1->imGuiData->preferredContentSize.x < w2->imGuiData->preferredContentSize.x)
-                return true;
-            if (w1->imGuiData->preferredContentSize.x > w2->imGuiData->preferredContentSize.x)
-                return false;
-            return w1->imGuiData->name() < w2->imGuiData->name();
-        };
+        if (windows.empty())
+            return;
         
-        std::set<Window*, decltype(isWindowHeightSmaller)> windowsSortedBySize(isWindowHeightSmaller);
-        for (const auto& win : _windows)
-            windowsSortedBySize.insert (win.get());
-
-        const float startX = windowListWidth + vp.Pos.x;
-        const float endX = vp.Pos.x + vp.Size.x;
-        const float startY = vp.Pos.y;
-        const float endY = vp.Pos.y + vp.Size.y;
+        // Decreasing height makes each shelf as tall as its first window.
+        std::sort(windows.begin(), windows.end(), [](const WindowData* lhs, const WindowData* rhs) {
+            const ImVec2 lhsSize = lhs->preferredWindowSize();
+            const ImVec2 rhsSize = rhs->preferredWindowSize();
+            if (lhsSize.y != rhsSize.y)
+                return lhsSize.y > rhsSize.y;
+            if (lhsSize.x != rhsSize.x)
+                return lhsSize.x > rhsSize.x;
+            return lhs->name() < rhs->name();
+        });
+        
+        auto& vp = *ImGui::GetMainViewport();
+        const ImVec2 origin (vp.Pos.x + windowListWidth, vp.Pos.y);
+        const ImVec2 available (std::max(0.f, vp.Size.x - windowListWidth), vp.Size.y);
         
         float scaleFactor = 1.0f;
-        bool didFit = false;
-        while (!didFit)
+        if (!packInShelves(windows, scaleFactor, available))
+        {
+            float fittingScale = 0.f;
+            float tooLargeScale = 1.f;
+            for (int i = 0; i < 16; ++i)
+            {
+                const float scale = (fittingScale + tooLargeScale) * 0.5f;
+                if (packInShelves(windows, scale, available))
+                    fittingScale = scale;
+                else
+                    tooLargeScale = scale;
+            }
+            
+            // Too many windows or no room at all (e.g. minimized).
+            if (fittingScale < minTilingScale)
+                return;
+            
+            scaleFactor = fittingScale;
+            packInShelves(windows, scaleFactor, available);
+        }
+        
+        const auto& positions = _cache.tiledPositions;
+        for (size_t i = 0; i < windows.size(); ++i)
+        {
+            auto* winData = windows[i];
+            const auto preferredSize = winData->preferredWindowSize();
+            winData->layoutUpdateOnNextFrame.size = ImVec2(preferredSize.x*scaleFactor, preferredSize.y*scaleFactor);
+            winData->layoutUpdateOnNextFrame.pos = ImVec2(origin.x + positions[i].x, origin.y + positions[i].y);
+            winData->layoutUpdateOnNextFrame.imGuiCond = ImGuiCond_Always;
+            winData->layoutUpdateOnNextFrame.hasData = true;
+        }
+    }
+    
+    // First fit decreasing height, the windows must be sorted by decreasing height.
+    // Fills _cache.tiledPositions relative to the top-left corner.
+    bool packInShelves(const std::vector<WindowData*>& windows, float scale, const ImVec2& available)
+    {
+        auto& shelves = _cache.tilingShelves;
+        auto& positions = _cache.tiledPositions;
+        shelves.clear();
+        positions.resize(windows.size());
+        
+        float nextShelfY = 0.f;
+        for (size_t i = 0; i < windows.size(); ++i)
         {
-            float currentX = startX;
-            float currentY = startY;
-            float maxHeightInCurrentRow = 0;
+            const auto preferredSize = windows[i]->preferredWindowSize();
+            const ImVec2 size (preferredSize.x*scale, preferredSize.y*scale);
+            if (size.x > available.x)
+                return false;
             
-            // Start optimistic.
-            didFit = true;
+            auto shelfIt = std::find_if(shelves.begin(), shelves.end(), [&](const Shelf& shelf) {
+                return shelf.usedWidth + size.x <= available.x;
+            });
             
-            for (auto& win : windowsSortedBySize)
+            if (shelfIt == shelves.end())
             {
-                auto* winData = win->imGuiData;
-                if (!winData->isVisible())
-                    continue;
-
-                // Don't reorganize docked windows.
-                if (winData->isDocked())
-                    continue;
-                
-                auto preferredSize = winData->preferredWindowSize();
-                ImVec2 scaledWinSize (preferredSize.x*scaleFactor,
-                                      preferredSize.y*scaleFactor);
-                
-                // Start new row?
-                if (currentX > startX && currentX + scaledWinSize.x > endX)
-                {
-                    currentX = startX;
-                    currentY += maxHeightInCurrentRow;
-                    maxHeightInCurrentRow = 0;
-                }
-                
-                // No more row? Start again from the top, but with an offset.
-                if (currentY + scaledWinSize.y > endY)
-                {
-                    didFit = false;
-                    // Retry with a smaller scale.
-                    scaleFactor *= 0.95;
-                    break;
-                }
-                
-                winData->layoutUpdateOnNextFrame.size = scaledWinSize;
-                winData->layoutUpdateOnNextFrame.pos = ImVec2(currentX, currentY);
-                winData->layoutUpdateOnNextFrame.imGuiCond = ImGuiCond_Always;
-                winData->layoutUpdateOnNextFrame.hasData = true;
-                ImGui::SetWindowFocus(winData->name().c_str());
-                
-                currentX += scaledWinSize.x;
-                maxHeightInCurrentRow = std::max(maxHeightInCurrentRow, scaledWinSize.y);
+                if (nextShelfY + size.y > available.y)
+                    return false;
+                shelves.push_back({nextShelfY, 0.f});
+                nextShelfY += size.y;
+                shelfIt = shelves.end() - 1;
             }
+            
+            positions[i] = ImVec2(shelfIt->usedWidth, shelfIt->y);
+            shelfIt->usedWidth += size.x;
         }
+        return true;
     }
     
     void MaybeRenderSaveCurrentLayout(const char* popupName)
@@ -305,13 +550,13 @@ public:
                         if (ImGui::MenuItem("Show All"))
                         {
                             for (const auto& winData : _windowsData)
-                                winData->isVisibleRef() = true;
+                                winData->setVisible(true);
                         }
 
                         if (ImGui::MenuItem("Hide All"))
                         {
                             for (const auto& winData : _windowsData)
-                                winData->isVisibleRef() = false;
+                                winData->setVisible(false);
                         }
                         
                         if (ImGui::MenuItem("Tile Windows"))
@@ -348,11 +593,21 @@ public:
                         ImGui::CVLog::ClearAll();
                     }
                     
+                    ImGui::MenuItem("Diagnostics", nullptr, &_diagnostics.showWindow);
+                    
                     ImGui::EndMenu();
                 }
                 
                 for (const auto& it : _menuBarCallbacks)
                     it.second();
+                
+                const uint64_t numDroppedTasks = GetTaskQueueStats().numDropped;
+                if (numDroppedTasks > 0)
+                {
+                    ImGui::TextColored(ImVec4(1,0.4,0.4,1), "%llu dropped tasks", (unsigned long long)numDroppedTasks);
+                    if (ImGui::IsItemHovered())
+                        ImGui::SetTooltip("The ImGui thread could not keep up, see SetTaskQueueLimits.");
+                }
                                     
                 // We need OpenPopup and BeginPopup to be at the same level.
                 if (openSavePopup)
@@ -361,81 +616,18 @@ public:
             }
             ImGui::EndMenuBar();
                         
-            for (auto& cat : _windowsPerCategory)
-            {
-                // 3-state checkbox for all the windows in the category.
-                bool showCat = false;
-                {
-                    const int checkboxWidth = ImGui::GetFrameHeight() - ImGui::GetStyle().FramePadding.x;
-                    
-                    showCat = ImGui::CollapsingHeader(cat.name.c_str(), ImGuiTreeNodeFlags_AllowItemOverlap | ImGuiTreeNodeFlags_DefaultOpen);
-                    
-                    ImGui::SameLine(GetContentRegionMax().x - checkboxWidth);
-                    
-                    int numVisible = 0;
-                    for (auto& winData : cat.windows)
-                        numVisible += winData->isVisible();
-                    
-                    bool mixedState = (numVisible > 0 && numVisible != cat.windows.size());
-                    
-                    if (mixedState)
-                    {
-                        ImGui::PushItemFlag(ImGuiItemFlags_MixedValue, true);
-                    }
-                    
-                    bool selected = (numVisible == cat.windows.size());
-                    if (ImGui::Checkbox(("##" + cat.name).c_str(), &selected))
-                    {
-                        for (auto& winData : cat.windows)
-                            winData->isVisibleRef() = selected;
-                    }
-                    
-                    if (mixedState)
-                        ImGui::PopItemFlag();
-                }
-                                
-                if (!showCat)
-                    continue;
-                
-                for (auto& winData : cat.windows)
-                {
-                    const bool disabled = (winData->window == nullptr);
-                    if (disabled)
-                    {
-                        // Let us still enable the window in case the update code is conditioned by isVisible.
-                        // ImGui::PushItemFlag(ImGuiItemFlags_Disabled, true);
-                        ImGui::PushStyleVar(ImGuiStyleVar_Alpha, ImGui::GetStyle().Alpha * 0.5f);
-                    }
-                    
-                    if (ImGui::Checkbox(winData->name().c_str(), &winData->isVisibleRef()))
-                    {
-                        // Make sure we save the new visible state.
-                        ImGui::MarkIniSettingsDirty();
-                    }
-                    
-                    if (ImGui::IsItemHovered())
-                    {
-                        ImGui::BeginTooltip();
-                        ImGui::PushTextWrapPos(ImGui::GetFontSize() * 35.0f);
-                        ImGui::TextUnformatted(winData->name().c_str());
-                        ImGui::TextUnformatted(winData->helpString.c_str());
-                        ImGui::PopTextWrapPos();
-                        ImGui::EndTooltip();
-                    }
-                    
-                    if (disabled)
-                    {
-                        // ImGui::PopItemFlag();
-                        ImGui::PopStyleVar();
-                    }
-                }
-            }
+            renderWindowList();
         }
         ImGui::End();
         
+        scheduleRefreshes();
+        
+        const auto windowsStartTime = std::chrono::steady_clock::now();
         for (auto& winData : _windowsData)
         {
-            if (winData->window && winData->isVisible())
+            float renderTimeMs = 0.f;
+            Window* window = winData->window.load(std::memory_order_relaxed);
+            if (window && winData->isVisible())
             {
                 if (winData->layoutUpdateOnNextFrame.hasData)
                 {
@@ -446,7 +638,12 @@ public:
                     ImGui::MarkIniSettingsDirty();
                 }
                     
-                if (winData->window->Begin(&winData->isVisibleRef()))
+                bool open = true;
+                const bool contentVisible = window->Begin(&open);
+                if (!open)
+                    winData->setVisible(false);
+                winData->imGuiWindow = ImGui::GetCurrentWindow();
+                if (contentVisible)
                 {
                     winData->setPreferredWindowSize(ImGui::GetWindowSize());
                     winData->isDockedRef() = ImGui::IsWindowDocked();
@@ -465,7 +662,7 @@ public:
                 
                 if (!winData->preRenderCallbacks.empty())
                 {
-                    if (winData->window->Begin(nullptr))
+                    if (window->Begin(nullptr))
                     {
                         for (const auto& it : winData->preRenderCallbacks)
                             it.second();
@@ -473,20 +670,43 @@ public:
                     ImGui::End();
                 }
                 
-                winData->window->Render();
+                const auto renderStartTime = std::chrono::steady_clock::now();
+                if (winData->refreshThisFrame)
+                    window->Render();
+                else
+                    window->RenderStale();
+                renderTimeMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - renderStartTime).count();
+                
+                // Smoothed, a single slow frame should not make it stale for long.
+                if (winData->refreshThisFrame)
+                    winData->estimatedRenderTimeMs += (renderTimeMs - winData->estimatedRenderTimeMs) * 0.2f;
             }
+            
+            updateWindowStats(*winData, renderTimeMs);
         }
+        
+        updateEffectiveVisibility();
+        
+        _diagnostics.windowsRenderTimeMs.add(std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - windowsStartTime).count());
+        _diagnostics.kbUploaded.add(_diagnostics.currentFrameBytesUploaded / 1024.f);
+        _diagnostics.currentFrameBytesUploaded = 0;
+        
+        if (_diagnostics.showWindow)
+            renderDiagnosticsWindow();
     }
     
     WindowData* ConcurrentFindWindowById(ImGuiID id)
     {
-        void* window = concurrent.windowsByID.GetVoidPtr(id);
-        return reinterpret_cast<WindowData*>(window);
+        return concurrent.windowsByID.find(id);
     }
 
     WindowData* ConcurrentFindWindow (const char* name)
     {
-        ImGuiID id = ImHashStr(name);
+        return ConcurrentFindWindow(name, ImHashStr(name));
+    }
+    
+    WindowData* ConcurrentFindWindow (const char* name, ImGuiID id)
+    {
         WindowData* windowData = ConcurrentFindWindowById(id);
         
         if (windowData == nullptr)
@@ -498,6 +718,140 @@ public:
     }
     
 private:
+    // Only the rows in view get submitted, so it stays cheap with thousands of windows.
+    void renderWindowList()
+    {
+        ImGui::SetNextItemWidth(-FLT_MIN);
+        ImGui::InputTextWithHint("##Filter", "Filter", _windowListFilter.text, IM_ARRAYSIZE(_windowListFilter.text));
+        
+        if (_windowListFilter.text[0] != '\0')
+        {
+            updateWindowListFilterMatches();
+            
+            const auto& matches = _windowListFilter.matches;
+            ImGuiListClipper clipper;
+            clipper.Begin((int)matches.size());
+            while (clipper.Step())
+            {
+                for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; ++i)
+                    renderWindowListItem(*matches[i]);
+            }
+            return;
+        }
+        
+        for (auto& catPtr : _windowsPerCategory)
+        {
+            auto& cat = *catPtr;
+            ImGui::PushID(&cat);
+            
+            // 3-state checkbox for all the windows in the category.
+            const int checkboxWidth = ImGui::GetFrameHeight() - ImGui::GetStyle().FramePadding.x;
+            
+            const bool showCat = ImGui::CollapsingHeader(cat.name.c_str(), ImGuiTreeNodeFlags_AllowItemOverlap | ImGuiTreeNodeFlags_DefaultOpen);
+            
+            ImGui::SameLine(GetContentRegionMax().x - checkboxWidth);
+            
+            const bool mixedState = (cat.numVisible > 0 && cat.numVisible != (int)cat.windows.size());
+            if (mixedState)
+                ImGui::PushItemFlag(ImGuiItemFlags_MixedValue, true);
+            
+            bool selected = (cat.numVisible == (int)cat.windows.size());
+            if (ImGui::Checkbox("##CategoryVisible", &selected))
+            {
+                for (auto& winData : cat.windows)
+                    winData->setVisible(selected);
+            }
+            
+            if (mixedState)
+                ImGui::PopItemFlag();
+            
+            if (showCat)
+            {
+                ImGuiListClipper clipper;
+                clipper.Begin((int)cat.windows.size());
+                while (clipper.Step())
+                {
+                    for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; ++i)
+                        renderWindowListItem(*cat.windows[i]);
+                }
+            }
+            
+            ImGui::PopID();
+        }
+    }
+    
+    void renderWindowListItem(WindowData& winData)
+    {
+        const bool disabled = (winData.window == nullptr);
+        if (disabled)
+        {
+            // Let us still enable the window in case the update code is conditioned by isVisible.
+            // ImGui::PushItemFlag(ImGuiItemFlags_Disabled, true);
+            ImGui::PushStyleVar(ImGuiStyleVar_Alpha, ImGui::GetStyle().Alpha * 0.5f);
+        }
+        
+        bool visible = winData.isVisible();
+        if (ImGui::Checkbox(winData.name().c_str(), &visible))
+        {
+            winData.setVisible(visible);
+            // Make sure we save the new visible state.
+            ImGui::MarkIniSettingsDirty();
+        }
+        
+        if (ImGui::IsItemHovered())
+        {
+            ImGui::BeginTooltip();
+            ImGui::PushTextWrapPos(ImGui::GetFontSize() * 35.0f);
+            ImGui::TextUnformatted(winData.name().c_str());
+            ImGui::TextDisabled("%s", winData.category.c_str());
+            ImGui::TextUnformatted(winData.helpString.c_str());
+            ImGui::PopTextWrapPos();
+            ImGui::EndTooltip();
+        }
+        
+        if (disabled)
+        {
+            // ImGui::PopItemFlag();
+            ImGui::PopStyleVar();
+        }
+    }
+    
+    // Case insensitive substring match. When the filter only got longer, e.g.
+    // while typing, the new matches are a subset of the previous ones.
+    void updateWindowListFilterMatches()
+    {
+        auto& filter = _windowListFilter;
+        const char* text = filter.text;
+        const char* textEnd = text + strlen(text);
+        auto isMatch = [&](const WindowData* winData) {
+            const char* name = winData->name().c_str();
+            return ImStristr(name, name + winData->name().size(), text, textEnd) != nullptr;
+        };
+        
+        const bool upToDate = filter.generationOfMatches == _windowListGeneration;
+        if (upToDate && filter.textOfMatches == text)
+            return;
+        
+        const bool canRefine = upToDate && ImStristr(text, textEnd, filter.textOfMatches.c_str(), filter.textOfMatches.c_str() + filter.textOfMatches.size());
+        if (canRefine)
+        {
+            filter.matches.erase(std::remove_if(filter.matches.begin(), filter.matches.end(), [&](const WindowData* winData) {
+                return !isMatch(winData);
+            }), filter.matches.end());
+        }
+        else
+        {
+            filter.matches.clear();
+            for (const auto& cat : _windowsPerCategory)
+                for (auto* winData : cat->windows)
+                    if (isMatch(winData))
+                        filter.matches.push_back(winData);
+        }
+        
+        filter.textOfMatches = text;
+        filter.generationOfMatches = _windowListGeneration;
+    }
+    
     void helpMarker(const char* desc)
     {
         ImGui::TextDisabled("(?)");
@@ -517,64 +871,852 @@ private:
         auto* winData = _windowsData.back().get();
         winData->category = categoryName;
         
-        auto& cat = findOrCreateCategory(categoryName);
-        cat.windows.emplace_back(winData);
+        addToCategory(findOrCreateCategory(categoryName), *winData);
         
-        {
-            std::lock_guard<std::mutex> _(concurrent.lock);
-            concurrent.windowsByID.SetVoidPtr(winData->id(), winData);
-        }
+        concurrent.windowsByID.insert(winData->id(), winData);
 
         return *winData;
     }
     
-    WindowCategory& findOrCreateCategory(const char* categoryName)
+    // Picks the windows that get a full Render this frame. Windows about to
+    // exceed maxStaleFrames go first, then by priority, then the stalest ones
+    // so the others get refreshed round-robin.
+    void scheduleRefreshes()
     {
-        for (auto& cat : _windowsPerCategory)
-            if (cat.name == categoryName)
-                return cat;
-        _windowsPerCategory.push_back(WindowCategory());
-        _windowsPerCategory.back().name = categoryName;
-        return _windowsPerCategory.back();
+        if (_frameBudget.budgetMs <= 0.f)
+        {
+            for (auto& winData : _windowsData)
+            {
+                winData->refreshThisFrame = true;
+                winData->numStaleFrames = 0;
+            }
+            return;
+        }
+        
+        auto& candidates = _cache.refreshCandidates;
+        candidates.clear();
+        for (auto& winData : _windowsData)
+        {
+            winData->refreshThisFrame = true;
+            if (winData->window.load(std::memory_order_relaxed) && winData->isVisible())
+                candidates.push_back(winData.get());
+        }
+        
+        const int maxStaleFrames = _frameBudget.maxStaleFrames;
+        std::sort(candidates.begin(), candidates.end(), [maxStaleFrames](const WindowData* lhs, const WindowData* rhs) {
+            const bool lhsForced = lhs->numStaleFrames >= maxStaleFrames;
+            const bool rhsForced = rhs->numStaleFrames >= maxStaleFrames;
+            if (lhsForced != rhsForced)
+                return lhsForced;
+            if (lhs->priority != rhs->priority)
+                return lhs->priority > rhs->priority;
+            return lhs->numStaleFrames > rhs->numStaleFrames;
+        });
+        
+        float remainingBudgetMs = _frameBudget.budgetMs;
+        for (auto* winData : candidates)
+        {
+            const bool forced = winData->numStaleFrames >= maxStaleFrames;
+            winData->refreshThisFrame = forced || winData->estimatedRenderTimeMs <= remainingBudgetMs;
+            if (winData->refreshThisFrame)
+            {
+                remainingBudgetMs -= winData->estimatedRenderTimeMs;
+                winData->numStaleFrames = 0;
+            }
+            else
+            {
+                ++winData->numStaleFrames;
+                // Needs another frame to catch up.
+                RequestRedraw();
+            }
+        }
     }
     
+    void updateWindowStats(WindowData& winData, float renderTimeMs)
+    {
+        auto& stats = winData.stats;
+        
+        const uint64_t totalLockWaitNs = stats.totalLockWaitNs.load(std::memory_order_relaxed);
+        stats.lockWaitUs.add((totalLockWaitNs - stats.totalLockWaitNsAtLastFrame) / 1000.f);
+        stats.totalLockWaitNsAtLastFrame = totalLockWaitNs;
+        
+        stats.renderTimeMs.add(renderTimeMs);
+        stats.samplesIngested.add(stats.numSamplesIngested);
+        stats.kbUploaded.add(stats.numBytesUploaded / 1024.f);
+        _diagnostics.currentFrameBytesUploaded += stats.numBytesUploaded;
+        stats.numSamplesIngested = 0;
+        stats.numBytesUploaded = 0;
+    }
+    
+    void renderDiagnosticsWindow()
+    {
+        ImGui::SetNextWindowSize(ImVec2(520, 600), ImGuiCond_FirstUseEver);
+        if (ImGui::Begin("CVLog Diagnostics", &_diagnostics.showWindow))
+        {
+            if (ImGui::CollapsingHeader("Frame", ImGuiTreeNodeFlags_DefaultOpen))
+            {
+                _diagnostics.tasksDrained.plot("Tasks drained", "%.0f (avg %.1f, max %.0f)");
+                _diagnostics.taskLoopTimeMs.plot("Task loop", "%.3f ms (avg %.3f, max %.3f)");
+                _diagnostics.providersTimeMs.plot("Providers", "%.3f ms (avg %.3f, max %.3f)");
+                _diagnostics.windowsRenderTimeMs.plot("Windows", "%.3f ms (avg %.3f, max %.3f)");
+                _diagnostics.kbUploaded.plot("Textures", "%.0f KB (avg %.0f, max %.0f)");
+            }
+            
+            if (ImGui::CollapsingHeader("Task queue", ImGuiTreeNodeFlags_DefaultOpen))
+            {
+                const TaskQueueStats stats = GetTaskQueueStats();
+                ImGui::Text("Depth: %zu / %zu", stats.approximateSize, stats.capacity);
+                ImGui::Text("Enqueued: %llu, contended: %llu, overflows: %llu",
+                            (unsigned long long)stats.numEnqueued,
+                            (unsigned long long)stats.numContendedEnqueues,
+                            (unsigned long long)stats.numOverflows);
+                ImGui::Text("Dropped: %llu, blocked: %llu",
+                            (unsigned long long)stats.numDropped,
+                            (unsigned long long)stats.numBlocked);
+                ImGui::Text("Enqueue latency: avg %.2f us, max %.2f us",
+                            stats.numLatencySamples > 0 ? stats.totalEnqueueLatencyNs / 1000.0 / stats.numLatencySamples : 0.0,
+                            stats.maxEnqueueLatencyNs / 1000.0);
+                ImGui::Text("Arena heap fallbacks: %llu", (unsigned long long)stats.numHeapAllocations);
+            }
+            
+            for (const auto& it : _diagnostics.callbacks)
+            {
+                if (ImGui::CollapsingHeader(it.first.c_str(), ImGuiTreeNodeFlags_DefaultOpen))
+                    it.second();
+            }
+            
+            if (ImGui::CollapsingHeader("Windows", ImGuiTreeNodeFlags_DefaultOpen))
+            {
+                const ImGuiTableFlags flags = ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg | ImGuiTableFlags_ScrollY | ImGuiTableFlags_Resizable;
+                if (ImGui::BeginTable("##WindowStats", 6, flags))
+                {
+                    ImGui::TableSetupScrollFreeze(0, 1);
+                    ImGui::TableSetupColumn("Window");
+                    ImGui::TableSetupColumn("Render (ms)");
+                    ImGui::TableSetupColumn("Samples");
+                    ImGui::TableSetupColumn("Upload (KB)");
+                    ImGui::TableSetupColumn("Lock wait (us)");
+                    ImGui::TableSetupColumn("Stale frames");
+                    ImGui::TableHeadersRow();
+                    
+                    // Averages over the history, the last frame is too noisy to read.
+                    ImGuiListClipper clipper;
+                    clipper.Begin((int)_windowsData.size());
+                    while (clipper.Step())
+                    {
+                        for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; ++i)
+                        {
+                            const auto& winData = *_windowsData[i];
+                            const auto& stats = winData.stats;
+                            ImGui::TableNextRow();
+                            ImGui::TableNextColumn();
+                            ImGui::TextUnformatted(winData.name().c_str());
+                            ImGui::TableNextColumn();
+                            ImGui::Text("%.3f", stats.renderTimeMs.average());
+                            ImGui::TableNextColumn();
+                            ImGui::Text("%.1f", stats.samplesIngested.average());
+                            ImGui::TableNextColumn();
+                            ImGui::Text("%.1f", stats.kbUploaded.average());
+                            ImGui::TableNextColumn();
+                            ImGui::Text("%.1f", stats.lockWaitUs.average());
+                            ImGui::TableNextColumn();
+                            ImGui::Text("%d", winData.numStaleFrames);
+                        }
+                    }
+                    ImGui::EndTable();
+                }
+            }
+        }
+        ImGui::End();
+    }
+    
+    // Needs to run once all the windows got submitted for this frame.
+    void updateEffectiveVisibility()
+    {
+        ImGuiContext& g = *GImGui;
+        
+        // Display order of the root windows, and the opaque ones that can cover others.
+        auto& displayOrder = _cache.displayOrderOfRootWindows;
+        auto& occluders = _cache.occluders;
+        displayOrder.Clear();
+        occluders.clear();
+        for (int i = 0; i < g.Windows.Size; ++i)
+        {
+            ImGuiWindow* other = g.Windows[i];
+            if (other->Flags & ImGuiWindowFlags_ChildWindow)
+                continue;
+            
+            displayOrder.Data.push_back(ImGuiStorage::ImGuiStoragePair(other->ID, i));
+            
+            const bool isOpaque = !(other->Flags & (ImGuiWindowFlags_NoBackground | ImGuiWindowFlags_Tooltip));
+            if (isOpaque && (other->Active || other->WasActive) && !other->Hidden)
+                occluders.push_back({i, other->Rect(), other->Viewport});
+        }
+        displayOrder.BuildSortByKey();
+        
+        for (auto& winData : _windowsData)
+        {
+            ImGuiWindow* imGuiWindow = winData->imGuiWindow;
+            
+            // Only data so far (SetWindowProperties, the .ini or a priority), keep it
+            // enabled in case the update code that creates it is conditioned by isVisible.
+            if (!winData->window.load(std::memory_order_relaxed) || !imGuiWindow)
+            {
+                winData->setEffectivelyVisible(winData->isVisible());
+                continue;
+            }
+            
+            // Begin returns false when collapsed or in a hidden tab.
+            bool visible = winData->isVisible()
+                && imGuiWindow->Active
+                && !imGuiWindow->SkipItems;
+            
+            const ImRect rect = visible ? imGuiWindow->Rect() : ImRect();
+            
+            // Off-screen.
+            if (visible && imGuiWindow->Viewport)
+                visible = rect.Overlaps(imGuiWindow->Viewport->GetMainRect());
+            
+            // Fully covered by a single window in front of it. Only compare within
+            // the same viewport since the order of the OS windows is unknown.
+            if (visible)
+            {
+                const int displayIndex = displayOrder.GetInt(imGuiWindow->RootWindowDockTree->ID, -1);
+                for (const auto& occluder : occluders)
+                {
+                    if (occluder.displayIndex > displayIndex
+                        && occluder.viewport == imGuiWindow->Viewport
+                        && occluder.rect.Contains(rect))
+                    {
+                        visible = false;
+                        break;
+                    }
+                }
+            }
+            
+            winData->setEffectivelyVisible(visible);
+        }
+    }
+    
+    WindowCategory& findOrCreateCategory(const char* categoryName)
+    {
+        _cache.categoryName = categoryName;
+        auto it = _categoryIndexByName.find(_cache.categoryName);
+        if (it != _categoryIndexByName.end())
+            return *_windowsPerCategory[it->second];
+        
+        _categoryIndexByName.emplace(_cache.categoryName, _windowsPerCategory.size());
+        _windowsPerCategory.push_back(std::make_unique<WindowCategory>());
+        _windowsPerCategory.back()->name = categoryName;
+        return *_windowsPerCategory.back();
+    }
+    
+    void addToCategory(WindowCategory& cat, WindowData& data)
+    {
+        data.categoryData = &cat;
+        data.indexInCategory = cat.windows.size();
+        cat.windows.push_back(&data);
+        cat.numVisible += data.isVisible();
+        ++_windowListGeneration;
+    }
+    
+    // Swaps with the last window, so the order within the category changes.
+    void removeFromCategory(WindowCategory& cat, WindowData& data)
+    {
+        IM_ASSERT(cat.windows[data.indexInCategory] == &data);
+        WindowData* lastData = cat.windows.back();
+        cat.windows[data.indexInCategory] = lastData;
+        lastData->indexInCategory = data.indexInCategory;
+        cat.windows.pop_back();
+        cat.numVisible -= data.isVisible();
+        data.categoryData = nullptr;
+        ++_windowListGeneration;
+    }
+    
+    // The ImGui thread is the only writer, so it can always read the index.
     WindowData* findDataForWindow (const ImGuiID& windowID)
     {
-        for (auto& data : _windowsData)
-            if (data->id() == windowID)
-                return data.get();
-        return nullptr;
+        return concurrent.windowsByID.find(windowID);
     }
     
 private:
     // Might get accessed as read-only by other threads.
-    // If you want to modify it, you need to grab a lock.
+    // Only the ImGui thread can modify it.
     struct
     {
-        std::mutex lock;
-        ImGuiStorage windowsByID;
+        WindowIndex windowsByID;
     } concurrent;
     
 private:
     std::vector<std::unique_ptr<Window>> _windows;
     std::vector<std::unique_ptr<WindowData>> _windowsData;
-    std::vector<WindowCategory> _windowsPerCategory;
+    // Pointers so that WindowData::categoryData stays valid.
+    std::vector<std::unique_ptr<WindowCategory>> _windowsPerCategory;
+    std::unordered_map<std::string, size_t> _categoryIndexByName;
+    
+    // Bumped when windows get added or change category, invalidates the filter matches.
+    int _windowListGeneration = 0;
+    
+    struct
+    {
+        char text[128] = "";
+        std::string textOfMatches;
+        std::vector<WindowData*> matches;
+        int generationOfMatches = -1;
+    } _windowListFilter;
     std::unordered_map<std::string, std::function<void(void)>> _menuBarCallbacks;
     char _pathBuffer[256];
+    
+    struct Shelf
+    {
+        float y;
+        float usedWidth;
+    };
+    
+    struct Occluder
+    {
+        int displayIndex;
+        ImRect rect;
+        ImGuiViewport* viewport;
+    };
+    
+    // Kept to avoid reallocations.
+    struct
+    {
+        ImGuiStorage displayOrderOfRootWindows;
+        std::vector<Occluder> occluders;
+        std::vector<WindowData*> refreshCandidates;
+        std::string categoryName; // avoids a temporary string for each lookup.
+        std::vector<WindowData*> tiledWindows;
+        std::vector<ImVec2> tiledPositions;
+        std::vector<Shelf> tilingShelves;
+    } _cache;
+    
+    struct
+    {
+        float budgetMs = 0.f; // disabled.
+        int maxStaleFrames = 10;
+    } _frameBudget;
+    
+    // Always collected so the history is there when opening the window.
+    struct
+    {
+        bool showWindow = false;
+        std::map<std::string, std::function<void(void)>> callbacks;
+        
+        size_t currentFrameBytesUploaded = 0;
+        
+        RollingHistory tasksDrained;
+        RollingHistory taskLoopTimeMs;
+        RollingHistory providersTimeMs;
+        RollingHistory windowsRenderTimeMs;
+        RollingHistory kbUploaded;
+    } _diagnostics;
+};
+
+// Bounded multi-producer multi-consumer queue based on Dmitry Vyukov's algorithm.
+// Each cell has a sequence number telling whether it's ready to be written
+// or read for a given position, so producers only compete on a single CAS
+// of the enqueue position and never block each other. Pops are mostly done
+// by the ImGui thread, but producers evicting old tasks pop too.
+template <class T>
+class BoundedQueue
+{
+public:
+    // Capacity gets rounded up to a power of two.
+    BoundedQueue(size_t minCapacity)
+    {
+        size_t capacity = 2;
+        while (capacity < minCapacity)
+            capacity *= 2;
+        _cells.reset(new Cell[capacity]);
+        _mask = capacity - 1;
+        for (size_t i = 0; i < capacity; ++i)
+            _cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    
+    ~BoundedQueue()
+    {
+        T value;
+        while (tryPop(value)) {}
+    }
+    
+    size_t capacity() const { return _mask + 1; }
+    
+    size_t approximateSize() const
+    {
+        const size_t enqueuePos = _enqueuePos.load(std::memory_order_relaxed);
+        const size_t dequeuePos = _dequeuePos.load(std::memory_order_relaxed);
+        return enqueuePos > dequeuePos ? enqueuePos - dequeuePos : 0;
+    }
+    
+    // Returns false if the queue was full. numRetries gets incremented each time
+    // another producer got the slot first.
+    bool tryPush(T&& value, int& numRetries)
+    {
+        Cell* cell = nullptr;
+        size_t pos = _enqueuePos.load(std::memory_order_relaxed);
+        while (true)
+        {
+            cell = &_cells[pos & _mask];
+            const size_t seq = cell->sequence.load(std::memory_order_acquire);
+            const intptr_t diff = intptr_t(seq) - intptr_t(pos);
+            if (diff == 0)
+            {
+                if (_enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+                ++numRetries;
+            }
+            else if (diff < 0)
+            {
+                return false;
+            }
+            else
+            {
+                pos = _enqueuePos.load(std::memory_order_relaxed);
+                ++numRetries;
+            }
+        }
+        new (cell->storage) T(std::move(value));
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+    
+    bool tryPop(T& value)
+    {
+        Cell* cell = nullptr;
+        size_t pos = _dequeuePos.load(std::memory_order_relaxed);
+        while (true)
+        {
+            cell = &_cells[pos & _mask];
+            const size_t seq = cell->sequence.load(std::memory_order_acquire);
+            const intptr_t diff = intptr_t(seq) - intptr_t(pos + 1);
+            if (diff == 0)
+            {
+                if (_dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if (diff < 0)
+            {
+                return false;
+            }
+            else
+            {
+                pos = _dequeuePos.load(std::memory_order_relaxed);
+            }
+        }
+        T* storedValue = reinterpret_cast<T*>(cell->storage);
+        value = std::move(*storedValue);
+        storedValue->~T();
+        cell->sequence.store(pos + _mask + 1, std::memory_order_release);
+        return true;
+    }
+    
+private:
+    struct Cell
+    {
+        std::atomic<size_t> sequence;
+        alignas(T) unsigned char storage[sizeof(T)];
+    };
+    
+    std::unique_ptr<Cell[]> _cells;
+    size_t _mask = 0;
+    
+    // Keep the push and pop sides on separate cache lines.
+    alignas(64) std::atomic<size_t> _enqueuePos { 0 };
+    alignas(64) std::atomic<size_t> _dequeuePos { 0 };
+};
+
+struct FrameArenaPage
+{
+    static constexpr size_t size = 256*1024;
+    
+    std::unique_ptr<unsigned char[]> data { new unsigned char[size] };
+    std::atomic<size_t> offset { 0 };
+    std::atomic<int> numLeases { 0 };
+};
+
+// Two pages used alternatively. A producer takes a lease on the active one
+// and keeps it until its task gets destroyed in the ImGui thread. Once per
+// frame we switch to the other page if nobody is using it anymore, and reset
+// it in bulk.
+class FrameArena
+{
+public:
+    TaskStorage acquire()
+    {
+        while (true)
+        {
+            const int pageIndex = _activePage.load();
+            FrameArenaPage& page = _pages[pageIndex];
+            page.numLeases.fetch_add(1);
+            // The page might have been retired in the meantime, in which case it can
+            // get reset at any time, release it.
+            if (_activePage.load() == pageIndex)
+                return TaskStorage(&page);
+            page.numLeases.fetch_sub(1);
+        }
+    }
+    
+    // Only from the ImGui thread.
+    void recycle()
+    {
+        const int nextPageIndex = 1 - _activePage.load();
+        FrameArenaPage& nextPage = _pages[nextPageIndex];
+        if (nextPage.numLeases.load() != 0)
+            return;
+        nextPage.offset.store(0, std::memory_order_relaxed);
+        _activePage.store(nextPageIndex);
+    }
+    
+    uint64_t numHeapAllocations() const { return _numHeapAllocations.load(std::memory_order_relaxed); }
+    void addHeapAllocation() { _numHeapAllocations.fetch_add(1, std::memory_order_relaxed); }
+    
+private:
+    FrameArenaPage _pages[2];
+    std::atomic<int> _activePage { 0 };
+    std::atomic<uint64_t> _numHeapAllocations { 0 };
+};
+
+// Tasks to run on the ImGui thread. The fast path is lock-free, but when
+// the ring is full we fallback to a list protected by a mutex so no task
+// ever gets lost. Once the overflow list is in use all the producers go
+// there until the next Render() to preserve the order of the tasks.
+class TaskQueue
+{
+public:
+    static constexpr size_t defaultCapacity = 4096;
+    
+    // Reading the clock twice costs about as much as the push itself.
+    static constexpr uint32_t latencySamplingPeriod = 64;
+    
+public:
+    TaskQueue(size_t capacity = defaultCapacity) : _queue(capacity) {}
+    
+    void setLimits(const QueueLimits& limits)
+    {
+        _limits.capacity.store(limits.capacity, std::memory_order_relaxed);
+        _limits.policy.store(limits.policy, std::memory_order_relaxed);
+        _limits.blockTimeoutNs.store(int64_t(limits.blockTimeoutInSeconds * 1e9), std::memory_order_relaxed);
+    }
+    
+    // canWait is false for the consumer thread, it would wait for itself.
+    void push(Task&& task, bool canWait)
+    {
+        // The latency gets sampled on the fast path, but always measured on the slow ones.
+        thread_local uint32_t numPushesOnThisThread = 0;
+        bool measureLatency = (numPushesOnThisThread++ % latencySamplingPeriod) == 0;
+        std::chrono::steady_clock::time_point startTime;
+        if (measureLatency)
+            startTime = std::chrono::steady_clock::now();
+        
+        const size_t capacity = _limits.capacity.load(std::memory_order_relaxed);
+        if (capacity > 0 && canWait && _numPending.load(std::memory_order_relaxed) >= capacity)
+        {
+            if (!measureLatency)
+            {
+                startTime = std::chrono::steady_clock::now();
+                measureLatency = true;
+            }
+            
+            if (!makeRoomForOneTask(capacity, startTime))
+            {
+                _stats.numDropped.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+        }
+        _numPending.fetch_add(1, std::memory_order_relaxed);
+        
+        int numRetries = 0;
+        bool pushed = false;
+        if (!_overflow.inUse.load(std::memory_order_acquire))
+            pushed = _queue.tryPush(std::move(task), numRetries);
+        
+        if (!pushed)
+        {
+            if (!measureLatency)
+            {
+                startTime = std::chrono::steady_clock::now();
+                measureLatency = true;
+            }
+            
+            std::lock_guard<std::mutex> _ (_overflow.lock);
+            _overflow.tasks.emplace_back(std::move(task));
+            _overflow.inUse.store(true, std::memory_order_release);
+            _stats.numOverflows.fetch_add(1, std::memory_order_relaxed);
+        }
+        
+        _stats.numEnqueued.fetch_add(1, std::memory_order_relaxed);
+        if (numRetries > 0)
+        {
+            _stats.numContendedEnqueues.fetch_add(1, std::memory_order_relaxed);
+            _stats.numRetries.fetch_add(numRetries, std::memory_order_relaxed);
+        }
+        
+        if (!measureLatency)
+            return;
+        
+        const uint64_t latencyNs = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - startTime).count();
+        _stats.numLatencySamples.fetch_add(1, std::memory_order_relaxed);
+        _stats.totalEnqueueLatencyNs.fetch_add(latencyNs, std::memory_order_relaxed);
+        
+        uint64_t maxLatencyNs = _stats.maxEnqueueLatencyNs.load(std::memory_order_relaxed);
+        while (latencyNs > maxLatencyNs
+               && !_stats.maxEnqueueLatencyNs.compare_exchange_weak(maxLatencyNs, latencyNs, std::memory_order_relaxed))
+        {}
+    }
+    
+    // Only from the ImGui thread, the producers may pop concurrently with
+    // popOldest. Only takes what was in the queue when the call started, so busy producers can't keep us here forever.
+    void popAll(std::vector<Task>& tasks)
+    {
+        const size_t numTasksBefore = tasks.size();
+        
+        size_t numToPop = _queue.approximateSize();
+        Task task;
+        while (numToPop-- > 0 && _queue.tryPop(task))
+            tasks.emplace_back(std::move(task));
+        
+        if (_overflow.inUse.load(std::memory_order_acquire))
+        {
+            std::lock_guard<std::mutex> _ (_overflow.lock);
+            
+            // Whatever got in the ring before the overflow started must run first.
+            while (_queue.tryPop(task))
+                tasks.emplace_back(std::move(task));
+            
+            for (auto& overflowTask : _overflow.tasks)
+                tasks.emplace_back(std::move(overflowTask));
+            _overflow.tasks.clear();
+            _overflow.inUse.store(false, std::memory_order_release);
+        }
+        
+        _numPending.fetch_sub(tasks.size() - numTasksBefore, std::memory_order_relaxed);
+    }
+    
+    TaskQueueStats stats() const
+    {
+        // What the QueueLimits enforce, the ring alone is not a limit since it overflows.
+        TaskQueueStats stats;
+        const size_t capacityLimit = _limits.capacity.load(std::memory_order_relaxed);
+        stats.capacity = capacityLimit > 0 ? capacityLimit : _queue.capacity();
+        stats.ringCapacity = _queue.capacity();
+        stats.approximateSize = _numPending.load(std::memory_order_relaxed);
+        stats.numEnqueued = _stats.numEnqueued.load(std::memory_order_relaxed);
+        stats.numContendedEnqueues = _stats.numContendedEnqueues.load(std::memory_order_relaxed);
+        stats.numRetries = _stats.numRetries.load(std::memory_order_relaxed);
+        stats.numOverflows = _stats.numOverflows.load(std::memory_order_relaxed);
+        stats.numDropped = _stats.numDropped.load(std::memory_order_relaxed);
+        stats.numBlocked = _stats.numBlocked.load(std::memory_order_relaxed);
+        stats.numLatencySamples = _stats.numLatencySamples.load(std::memory_order_relaxed);
+        stats.totalEnqueueLatencyNs = _stats.totalEnqueueLatencyNs.load(std::memory_order_relaxed);
+        stats.maxEnqueueLatencyNs = _stats.maxEnqueueLatencyNs.load(std::memory_order_relaxed);
+        return stats;
+    }
+    
+private:
+    // Returns false if the new task should be dropped.
+    bool makeRoomForOneTask(size_t capacity, std::chrono::steady_clock::time_point startTime)
+    {
+        switch (_limits.policy.load(std::memory_order_relaxed))
+        {
+            case QueuePolicy::DropNewest:
+                return false;
+                
+            case QueuePolicy::DropOldest:
+            {
+                // Can fail if the consumer got them first, then there is room anyway.
+                if (popOldest())
+                    _stats.numDropped.fetch_add(1, std::memory_order_relaxed);
+                return true;
+            }
+                
+            case QueuePolicy::Block:
+            {
+                _stats.numBlocked.fetch_add(1, std::memory_order_relaxed);
+                const auto deadline = startTime + std::chrono::nanoseconds(_limits.blockTimeoutNs.load(std::memory_order_relaxed));
+                while (_numPending.load(std::memory_order_relaxed) >= capacity)
+                {
+                    if (std::chrono::steady_clock::now() >= deadline)
+                        return false;
+                    std::this_thread::sleep_for(std::chrono::microseconds(100));
+                }
+                return true;
+            }
+        }
+        return true;
+    }
+    
+    bool popOldest()
+    {
+        Task oldest;
+        if (_queue.tryPop(oldest))
+        {
+            _numPending.fetch_sub(1, std::memory_order_relaxed);
+            return true;
+        }
+        
+        std::lock_guard<std::mutex> _ (_overflow.lock);
+        
+        // Something might have been pushed to the ring since, it'd be older.
+        if (!_queue.tryPop(oldest))
+        {
+            if (_overflow.tasks.empty())
+                return false;
+            oldest = std::move(_overflow.tasks.front());
+            _overflow.tasks.erase(_overflow.tasks.begin());
+        }
+        _numPending.fetch_sub(1, std::memory_order_relaxed);
+        return true;
+    }
+    
+private:
+    BoundedQueue<Task> _queue;
+    
+    // Includes the overflow.
+    std::atomic<size_t> _numPending { 0 };
+    
+    struct
+    {
+        std::atomic<size_t> capacity { 0 };
+        std::atomic<QueuePolicy> policy { QueuePolicy::DropOldest };
+        std::atomic<int64_t> blockTimeoutNs { 0 };
+    } _limits;
+    
+    struct
+    {
+        mutable std::mutex lock;
+        std::vector<Task> tasks;
+        std::atomic<bool> inUse { false };
+    } _overflow;
+    
+    // Away from the queue positions, only touched once per push.
+    struct alignas(64)
+    {
+        std::atomic<uint64_t> numEnqueued { 0 };
+        std::atomic<uint64_t> numContendedEnqueues { 0 };
+        std::atomic<uint64_t> numRetries { 0 };
+        std::atomic<uint64_t> numOverflows { 0 };
+        std::atomic<uint64_t> numDropped { 0 };
+        std::atomic<uint64_t> numBlocked { 0 };
+        std::atomic<uint64_t> numLatencySamples { 0 };
+        std::atomic<uint64_t> totalEnqueueLatencyNs { 0 };
+        std::atomic<uint64_t> maxEnqueueLatencyNs { 0 };
+    } _stats;
+};
+
+// Runs the providers that should not block the ImGui thread.
+class WorkerPool
+{
+public:
+    ~WorkerPool()
+    {
+        {
+            std::lock_guard<std::mutex> _ (_lock);
+            _stopRequested = true;
+        }
+        _condition.notify_all();
+        for (auto& thread : _threads)
+            thread.join();
+    }
+    
+    void run(std::function<void(void)>&& f)
+    {
+        {
+            std::lock_guard<std::mutex> _ (_lock);
+            
+            // Started on first use, most applications won't need it.
+            if (_threads.empty())
+            {
+                const int numThreads = std::max(1u, std::thread::hardware_concurrency() / 2);
+                for (int i = 0; i < numThreads; ++i)
+                    _threads.emplace_back([this]() { workerLoop(); });
+            }
+            
+            _tasks.push_back(std::move(f));
+        }
+        _condition.notify_one();
+    }
+    
+private:
+    void workerLoop()
+    {
+        while (true)
+        {
+            std::function<void(void)> task;
+            {
+                std::unique_lock<std::mutex> lock (_lock);
+                _condition.wait(lock, [this]() { return _stopRequested || !_tasks.empty(); });
+                if (_stopRequested)
+                    return;
+                task = std::move(_tasks.front());
+                _tasks.pop_front();
+            }
+            task();
+        }
+    }
+    
+private:
+    std::mutex _lock;
+    std::condition_variable _condition;
+    std::deque<std::function<void(void)>> _tasks;
+    std::vector<std::thread> _threads;
+    bool _stopRequested = false;
+};
+
+struct WindowProvider
+{
+    std::string windowName;
+    ImGuiID windowId = 0;
+    std::function<void(void)> callback;
+    double refreshIntervalInSeconds = 0.0;
+    bool runInWorkerThread = false;
+    
+    // ImGui thread only.
+    double lastRunTime = -FLT_MAX;
+    
+    // Set by the ImGui thread, cleared by the worker once done.
+    std::atomic<bool> isRunningInWorker { false };
 };
 
 struct Context
 {
+    // Must outlive the tasks.
+    FrameArena frameArena;
+    
+    TaskQueue tasksForNextFrame;
+    
+    // Set by Render, tasks sent from there can't wait for a free slot.
+    std::atomic<std::thread::id> imGuiThread;
+    
     struct
     {
         std::mutex lock;
-        std::vector<std::function<void(void)>> tasksForNextFrame;
         std::map<std::string, std::function<void(void)>> tasksToRepeatForEachFrame;
     } concurrentTasks;
+    
+    struct
+    {
+        std::mutex lock;
+        std::map<std::string, std::shared_ptr<WindowProvider>> providersByWindowName;
+    } concurrentProviders;
+    
+    WorkerPool workerPool;
+    
+    struct
+    {
+        std::atomic<bool> pendingRedraw { false };
+        std::mutex wakeUpLock;
+        std::function<void(void)> wakeUpCallback;
+    } concurrentRedraw;
+    
+    // ImGui thread only, updated by RunWindowProviders.
+    double nextProviderRunTime = DBL_MAX;
         
     // Cache to avoid reallocating data on every frame.
     struct {
-        std::vector<std::function<void(void)>> tasksToRun;
+        std::vector<Task> tasksToRun;
+        std::vector<std::shared_ptr<WindowProvider>> providers;
     } cache;
     
     WindowManager windowManager;
@@ -590,6 +1732,64 @@ namespace CVLog
 
 Context* g_Context = new Context();
 
+std::atomic<bool> g_LoggingEnabled (true);
+
+void SetEnabled(bool enabled)
+{
+    g_LoggingEnabled.store(enabled, std::memory_order_relaxed);
+}
+
+struct TaskStorage::HeapBlock
+{
+    HeapBlock* next = nullptr;
+};
+
+TaskStorage::~TaskStorage()
+{
+    while (_heapBlocks)
+    {
+        HeapBlock* next = _heapBlocks->next;
+        _heapBlocks->~HeapBlock();
+        ::operator delete(_heapBlocks);
+        _heapBlocks = next;
+    }
+    
+    if (_page)
+        _page->numLeases.fetch_sub(1);
+}
+
+TaskStorage TaskStorage::acquire()
+{
+    return g_Context->frameArena.acquire();
+}
+
+void* TaskStorage::allocate(size_t size, size_t alignment)
+{
+    if (_page)
+    {
+        const size_t start = _page->offset.fetch_add(size + alignment - 1, std::memory_order_relaxed);
+        const size_t alignedStart = (start + alignment - 1) & ~(alignment - 1);
+        if (alignedStart + size <= FrameArenaPage::size)
+            return _page->data.get() + alignedStart;
+    }
+    
+    g_Context->frameArena.addHeapAllocation();
+    const size_t headerSize = (sizeof(HeapBlock) + alignment - 1) & ~(alignment - 1);
+    void* memory = ::operator new(headerSize + size);
+    _heapBlocks = new (memory) HeapBlock { _heapBlocks };
+    return static_cast<unsigned char*>(memory) + headerSize;
+}
+
+const char* TaskStorage::copyString(const char* str)
+{
+    if (str == nullptr)
+        return nullptr;
+    const size_t size = strlen(str) + 1;
+    char* copy = static_cast<char*>(allocate(size, 1));
+    memcpy(copy, str, size);
+    return copy;
+}
+
 const char* Window::name() const
 {
     return imGuiData->name().c_str();
@@ -597,9 +1797,154 @@ const char* Window::name() const
 
 bool Window::isVisible() const
 {
-    // Thread-safety is not a real issue here since it's just a boolean,
-    // no not taking any locking for performance reasons.
-    return imGuiData->isVisible();
+    return imGuiData->isEffectivelyVisible();
+}
+
+bool Window::acceptsUpdate() const
+{
+    return isVisible() && passesUpdatePolicy();
+}
+
+bool Window::passesUpdatePolicy() const
+{
+    auto& limits = imGuiData->concurrentUpdateLimits;
+    
+    const int keepEveryNth = limits.keepEveryNth.load(std::memory_order_relaxed);
+    if (keepEveryNth > 1 && limits.numUpdatesReceived.fetch_add(1, std::memory_order_relaxed) % keepEveryNth != 0)
+        return false;
+    
+    const int64_t minUpdateIntervalNs = limits.minUpdateIntervalNs.load(std::memory_order_relaxed);
+    if (minUpdateIntervalNs > 0)
+    {
+        const int64_t nowNs = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        int64_t nextUpdateTimeNs = limits.nextUpdateTimeNs.load(std::memory_order_relaxed);
+        if (nowNs < nextUpdateTimeNs)
+            return false;
+        
+        // Several producers can get there at once, only one gets the slot.
+        return limits.nextUpdateTimeNs.compare_exchange_strong(nextUpdateTimeNs, nowNs + minUpdateIntervalNs, std::memory_order_relaxed);
+    }
+    
+    return true;
+}
+
+const UpdatePolicy& Window::updatePolicy() const
+{
+    return imGuiData->updatePolicy;
+}
+
+bool Window::keepsLatestUpdateOnly() const
+{
+    return imGuiData->concurrentUpdateLimits.keepLatestOnly.load(std::memory_order_relaxed);
+}
+
+void Window::reportSamplesIngested(int numSamples)
+{
+    imGuiData->stats.numSamplesIngested += numSamples;
+}
+
+void Window::reportBytesUploaded(size_t numBytes)
+{
+    imGuiData->stats.numBytesUploaded += numBytes;
+}
+
+std::unique_lock<std::mutex> Window::lockMeasuringWait(std::mutex& mutex) const
+{
+    std::unique_lock<std::mutex> lock (mutex, std::try_to_lock);
+    if (lock.owns_lock())
+        return lock;
+    
+    const auto startTime = std::chrono::steady_clock::now();
+    lock.lock();
+    const uint64_t waitNs = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - startTime).count();
+    imGuiData->stats.totalLockWaitNs.fetch_add(waitNs, std::memory_order_relaxed);
+    return lock;
+}
+
+void SetWindowProvider(const char* windowName,
+                       const std::function<void(void)>& provider,
+                       double refreshIntervalInSeconds,
+                       bool runInWorkerThread)
+{
+    std::lock_guard<std::mutex> _ (g_Context->concurrentProviders.lock);
+    auto& providers = g_Context->concurrentProviders.providersByWindowName;
+    if (!provider)
+    {
+        providers.erase(windowName);
+        return;
+    }
+    
+    // A new object each time, a worker might still be running the previous one.
+    auto windowProvider = std::make_shared<WindowProvider>();
+    windowProvider->windowName = windowName;
+    windowProvider->windowId = ImHashStr(windowName);
+    windowProvider->callback = provider;
+    windowProvider->refreshIntervalInSeconds = refreshIntervalInSeconds;
+    windowProvider->runInWorkerThread = runInWorkerThread;
+    providers[windowName] = windowProvider;
+}
+
+void RunInWorkerThread(const std::function<void(void)>& f)
+{
+    g_Context->workerPool.run(std::function<void(void)>(f));
+}
+
+static void RunWindowProviders()
+{
+    auto& providers = g_Context->cache.providers;
+    {
+        std::lock_guard<std::mutex> _ (g_Context->concurrentProviders.lock);
+        for (const auto& it : g_Context->concurrentProviders.providersByWindowName)
+            providers.push_back(it.second);
+    }
+    
+    const double now = ImGui::GetTime();
+    double nextRunTime = DBL_MAX;
+    for (const auto& provider : providers)
+    {
+        if (now - provider->lastRunTime < provider->refreshIntervalInSeconds)
+        {
+            nextRunTime = std::min(nextRunTime, provider->lastRunTime + provider->refreshIntervalInSeconds);
+            continue;
+        }
+        
+        // Run it until the window exists, so it gets a chance to create it.
+        auto* windowData = g_Context->windowManager.ConcurrentFindWindow(provider->windowName.c_str(), provider->windowId);
+        const bool windowExists = windowData && windowData->window.load(std::memory_order_relaxed);
+        // Not scheduled, showing the window is an input anyway.
+        if (windowExists && !windowData->isEffectivelyVisible())
+            continue;
+        
+        if (!provider->runInWorkerThread)
+        {
+            provider->lastRunTime = now;
+            nextRunTime = std::min(nextRunTime, now + provider->refreshIntervalInSeconds);
+            provider->callback();
+            continue;
+        }
+        
+        // Don't pile up calls if it takes longer than the refresh interval.
+        // Not scheduled either, its new data will request a redraw.
+        if (provider->isRunningInWorker.exchange(true))
+            continue;
+        
+        provider->lastRunTime = now;
+        nextRunTime = std::min(nextRunTime, now + provider->refreshIntervalInSeconds);
+        g_Context->workerPool.run([provider]() {
+            provider->callback();
+            provider->isRunningInWorker.store(false);
+        });
+    }
+    providers.clear();
+    g_Context->nextProviderRunTime = nextRunTime;
+}
+
+double SecondsUntilNextScheduledUpdate()
+{
+    const double nextRunTime = g_Context->nextProviderRunTime;
+    if (nextRunTime == DBL_MAX)
+        return DBL_MAX;
+    return std::max(0.0, nextRunTime - ImGui::GetTime());
 }
 
 void SetPerFrameCallback(const char* callbackName,
@@ -622,17 +1967,18 @@ void SetWindowProperties(const char* windowName,
                          int preferredWidth, /* -1 for no change */
                          int preferredHeight /* -1 for no change */)
 {
-    std::string windowNameCopy = windowName ? windowName : "";
-    std::string categoryNameCopy = categoryName ? categoryName : "";
-    std::string helpStringCopy = helpString ? helpString : "";
+    auto storage = TaskStorage::acquire();
+    const char* windowNameCopy = storage.copyString(windowName ? windowName : "");
+    const char* categoryNameCopy = storage.copyString(categoryName);
+    const char* helpStringCopy = storage.copyString(helpString);
     
-    RunOnceInImGuiThread([=]() {
-        auto& winData = g_Context->windowManager.FindOrCreateDataForWindow(windowNameCopy.c_str());
+    RunOnceInImGuiThread(Task(std::move(storage), [=]() {
+        auto& winData = g_Context->windowManager.FindOrCreateDataForWindow(windowNameCopy);
 
-        if (!categoryNameCopy.empty())
-            g_Context->windowManager.SetWindowCategory(windowNameCopy.c_str(), categoryNameCopy.c_str());
+        if (categoryNameCopy && categoryNameCopy[0] != '\0')
+            g_Context->windowManager.SetWindowCategory(windowNameCopy, categoryNameCopy);
 
-        if (!helpStringCopy.empty())
+        if (helpStringCopy && helpStringCopy[0] != '\0')
             winData.helpString = helpStringCopy;
         
         if (preferredWidth > 0)
@@ -640,66 +1986,181 @@ void SetWindowProperties(const char* windowName,
         
         if (preferredHeight > 0)
             winData.preferredContentSize.y = preferredHeight;
+    }));
+}
+
+void SetWindowUpdatePolicy(const char* windowName, const UpdatePolicy& policy)
+{
+    auto storage = TaskStorage::acquire();
+    const char* windowNameCopy = storage.copyString(windowName ? windowName : "");
+    
+    RunOnceInImGuiThread(Task(std::move(storage), [=]() {
+        auto& winData = g_Context->windowManager.FindOrCreateDataForWindow(windowNameCopy);
+        winData.updatePolicy = policy;
+        
+        auto& limits = winData.concurrentUpdateLimits;
+        const int64_t minUpdateIntervalNs = policy.maxUpdatesPerSecond > 0.f ? int64_t(1e9 / policy.maxUpdatesPerSecond) : 0;
+        limits.minUpdateIntervalNs.store(minUpdateIntervalNs, std::memory_order_relaxed);
+        limits.keepEveryNth.store(std::max(policy.keepEveryNth, 1), std::memory_order_relaxed);
+        limits.keepLatestOnly.store(policy.keepLatestOnly, std::memory_order_relaxed);
+    }));
+}
+
+void SetFrameBudget(float budgetMs, int maxStaleFrames)
+{
+    RunOnceInImGuiThread([budgetMs, maxStaleFrames]() {
+        g_Context->windowManager.SetFrameBudget(budgetMs, maxStaleFrames);
     });
 }
 
+void SetWindowPriority(const char* windowName, int priority)
+{
+    auto storage = TaskStorage::acquire();
+    const char* windowNameCopy = storage.copyString(windowName ? windowName : "");
+    
+    RunOnceInImGuiThread(Task(std::move(storage), [=]() {
+        g_Context->windowManager.FindOrCreateDataForWindow(windowNameCopy).priority = priority;
+    }));
+}
+
 void SetWindowPreRenderCallback(const char* windowName,
                                 const char* callbackName,
                                 const std::function<void(void)>& callback)
 {
-    std::string windowNameCopy = windowName;
-    std::string callbackNameCopy = callbackName;
-    RunOnceInImGuiThread([windowNameCopy,callbackNameCopy,callback]() {
-        auto& winData = g_Context->windowManager.FindOrCreateDataForWindow(windowNameCopy.c_str());
-        if (callback)
+    auto storage = TaskStorage::acquire();
+    const char* windowNameCopy = storage.copyString(windowName);
+    const char* callbackNameCopy = storage.copyString(callbackName);
+    
+    // The callback itself gets copied in the arena, only its captures might allocate.
+    using Callback = std::function<void(void)>;
+    Callback* callbackCopy = new (storage.allocate(sizeof(Callback), alignof(Callback))) Callback(callback);
+    
+    struct CallbackDeleter
+    {
+        void operator()(Callback* callback) const { callback->~Callback(); }
+    };
+    std::unique_ptr<Callback, CallbackDeleter> callbackOwner (callbackCopy);
+    
+    RunOnceInImGuiThread(Task(std::move(storage), [windowNameCopy,callbackNameCopy,callbackOwner=std::move(callbackOwner)]() {
+        auto& winData = g_Context->windowManager.FindOrCreateDataForWindow(windowNameCopy);
+        if (*callbackOwner)
         {
-            winData.preRenderCallbacks[callbackNameCopy] = callback;
+            winData.preRenderCallbacks[callbackNameCopy] = std::move(*callbackOwner);
         }
         else
         {
             winData.preRenderCallbacks.erase(callbackNameCopy);
         }
-    });
+    }));
 }
 
 void AddMenuBarCallback(const char* name, const std::function<void(void)>& callback)
 {
-    std::string nameCopy = name;
-    RunOnceInImGuiThread([callback, nameCopy]() {
+    auto storage = TaskStorage::acquire();
+    const char* nameCopy = storage.copyString(name);
+    RunOnceInImGuiThread(Task(std::move(storage), [callback, nameCopy]() {
         g_Context->windowManager.AddMenuBarCallback(nameCopy, callback);
-    });
+    }));
+}
+
+void AddDiagnosticsCallback(const char* name, const std::function<void(void)>& callback)
+{
+    auto storage = TaskStorage::acquire();
+    const char* nameCopy = storage.copyString(name);
+    RunOnceInImGuiThread(Task(std::move(storage), [callback, nameCopy]() {
+        g_Context->windowManager.AddDiagnosticsCallback(nameCopy, callback);
+    }));
+}
+
+bool IsImGuiThread()
+{
+    return g_Context->imGuiThread.load(std::memory_order_relaxed) == std::this_thread::get_id();
 }
 
 void RunOnceInImGuiThread(const std::function<void(void)>& f)
 {
-    std::lock_guard<std::mutex> _ (g_Context->concurrentTasks.lock);
-    g_Context->concurrentTasks.tasksForNextFrame.emplace_back(f);
+    g_Context->tasksForNextFrame.push(Task(f), !IsImGuiThread());
+    RequestRedraw();
+}
+
+void RunOnceInImGuiThread(Task&& task)
+{
+    g_Context->tasksForNextFrame.push(std::move(task), !IsImGuiThread());
+    RequestRedraw();
+}
+
+void RequestRedraw()
+{
+    auto& redraw = g_Context->concurrentRedraw;
+    
+    // Plain load first to avoid bouncing the cache line between the producers.
+    if (redraw.pendingRedraw.load(std::memory_order_relaxed)
+        || redraw.pendingRedraw.exchange(true, std::memory_order_acq_rel))
+        return;
+    
+    std::lock_guard<std::mutex> _ (redraw.wakeUpLock);
+    if (redraw.wakeUpCallback)
+        redraw.wakeUpCallback();
+}
+
+bool HasPendingRedraw()
+{
+    return g_Context->concurrentRedraw.pendingRedraw.load(std::memory_order_acquire);
+}
+
+void SetWakeUpCallback(const std::function<void(void)>& callback)
+{
+    std::lock_guard<std::mutex> _ (g_Context->concurrentRedraw.wakeUpLock);
+    g_Context->concurrentRedraw.wakeUpCallback = callback;
+}
+
+void SetTaskQueueLimits(const QueueLimits& limits)
+{
+    g_Context->tasksForNextFrame.setLimits(limits);
+}
+
+TaskQueueStats GetTaskQueueStats()
+{
+    TaskQueueStats stats = g_Context->tasksForNextFrame.stats();
+    stats.numHeapAllocations = g_Context->frameArena.numHeapAllocations();
+    return stats;
 }
 
 Window* FindOrCreateWindow(const char* name, const std::function<Window*(void)>& createWindowFunc)
 {
     WindowData* windowData = g_Context->windowManager.ConcurrentFindWindow(name);
-    if (windowData && windowData->window)
-        return windowData->window;
+    Window* window = windowData ? windowData->window.load(std::memory_order_acquire) : nullptr;
+    if (window)
+        return window;
     
     auto* concreteWindow = createWindowFunc();
     g_Context->windowManager.AddWindow(name, std::unique_ptr<Window>(concreteWindow));
     return concreteWindow;
 }
 
-bool WindowIsVisible(const char* windowName, bool** persistentAddressOfFlag)
+bool WindowIsVisible(const char* windowName, const std::atomic<bool>** persistentAddressOfFlag)
+{
+    return WindowIsVisible(HashedName(windowName, ImHashStr(windowName)), persistentAddressOfFlag);
+}
+
+bool WindowIsVisible(const HashedName& windowName, const std::atomic<bool>** persistentAddressOfFlag)
 {
-    auto* windowData = g_Context->windowManager.ConcurrentFindWindow(windowName);
+    auto* windowData = g_Context->windowManager.ConcurrentFindWindow(windowName.name, windowName.id);
     if (persistentAddressOfFlag)
-        *persistentAddressOfFlag = windowData ? &(windowData->isVisibleRef()) : nullptr;
-    return windowData && windowData->isVisible();
+        *persistentAddressOfFlag = windowData ? &(windowData->isEffectivelyVisibleRef()) : nullptr;
+    return windowData && windowData->isEffectivelyVisible();
 }
 
 Window* FindWindow(const char* windowName)
 {
-    auto* windowData = g_Context->windowManager.ConcurrentFindWindow(windowName);
+    return FindWindow(HashedName(windowName, ImHashStr(windowName)));
+}
+
+Window* FindWindow(const HashedName& windowName)
+{
+    auto* windowData = g_Context->windowManager.ConcurrentFindWindow(windowName.name, windowName.id);
     if (windowData)
-        return windowData->window;
+        return windowData->window.load(std::memory_order_acquire);
     else
         return nullptr;
 }
@@ -724,7 +2185,7 @@ static void CVLogSettingsHandler_ReadLine(ImGuiContext*, ImGuiSettingsHandler*,
     int i;
     if (sscanf(line, "Visible=%d", &i) == 1)
     {
-        settings->isVisibleRef() = i;
+        settings->setVisible(i);
     }
 }
 
@@ -766,12 +2227,13 @@ void Init()
 
 void ClearWindow(const char* name)
 {
-    std::string nameCopy (name);
-    RunOnceInImGuiThread([nameCopy](){
-        auto* window = FindWindow(nameCopy.c_str());
+    auto storage = TaskStorage::acquire();
+    const char* nameCopy = storage.copyString(name);
+    RunOnceInImGuiThread(Task(std::move(storage), [nameCopy](){
+        auto* window = FindWindow(nameCopy);
         if (window)
             window->Clear();
-    });
+    }));
 }
 
 void ClearAll()
@@ -779,8 +2241,8 @@ void ClearAll()
     RunOnceInImGuiThread([](){
         for (const auto& winData : g_Context->windowManager.windowsData())
         {
-            if (winData->window)
-                winData->window->Clear();
+            if (Window* window = winData->window.load(std::memory_order_relaxed))
+                window->Clear();
         }
     });
 }
@@ -788,21 +2250,35 @@ void ClearAll()
 // Gui thread only.
 void Render()
 {
+    g_Context->imGuiThread.store(std::this_thread::get_id(), std::memory_order_relaxed);
+    
+    // Cleared before draining, anything arriving from now on needs another frame.
+    g_Context->concurrentRedraw.pendingRedraw.store(false, std::memory_order_release);
+    
+    const auto taskLoopStartTime = std::chrono::steady_clock::now();
+    g_Context->tasksForNextFrame.popAll(g_Context->cache.tasksToRun);
+    const int numTasksDrained = (int)g_Context->cache.tasksToRun.size();
+    
     {
         std::lock_guard<std::mutex> _ (g_Context->concurrentTasks.lock);
-        g_Context->cache.tasksToRun.insert (g_Context->cache.tasksToRun.begin(),
-                                            g_Context->concurrentTasks.tasksForNextFrame.begin(),
-                                            g_Context->concurrentTasks.tasksForNextFrame.end());
-        g_Context->concurrentTasks.tasksForNextFrame.clear();
-        
         for (const auto& it : g_Context->concurrentTasks.tasksToRepeatForEachFrame)
-            g_Context->cache.tasksToRun.push_back(it.second);
+            g_Context->cache.tasksToRun.emplace_back(it.second);
     }
     
     for (auto& task : g_Context->cache.tasksToRun)
         task();
     
+    // Destroying the tasks releases their arena leases.
     g_Context->cache.tasksToRun.clear();
+    g_Context->frameArena.recycle();
+    
+    const auto providersStartTime = std::chrono::steady_clock::now();
+    RunWindowProviders();
+    
+    const auto providersEndTime = std::chrono::steady_clock::now();
+    g_Context->windowManager.RecordTaskLoop(numTasksDrained,
+                                            std::chrono::duration<float, std::milli>(providersStartTime - taskLoopStartTime).count(),
+                                            std::chrono::duration<float, std::milli>(providersEndTime - providersStartTime).count());
     
     g_Context->windowManager.Render();
 }
@@ -837,10 +2313,11 @@ void CreateEmptyWindow(const char* windowName)
     
     // Need to create it, enqueue that in the list of tasks for the next frame;
     {
-        std::string windowNameCopy = windowName;
-        RunOnceInImGuiThread([windowNameCopy](){
-            EmptyWindow* emptyWindow = FindOrCreateWindow<EmptyWindow>(windowNameCopy.c_str());
-        });
+        auto storage = TaskStorage::acquire();
+        const char* windowNameCopy = storage.copyString(windowName);
+        RunOnceInImGuiThread(Task(std::move(storage), [windowNameCopy](){
+            FindOrCreateWindow<EmptyWindow>(windowNameCopy);
+        }));
     }
 }
 
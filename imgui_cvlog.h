@@ -4,13 +4,80 @@
 
 #include <imgui/imgui.h>
 
+/*!
+ Define CVLOG_ENABLED to 0 (e.g. in release builds) to compile out all the
+ CVLOG_* macros, including the evaluation of their arguments.
+*/
+#ifndef CVLOG_ENABLED
+#define CVLOG_ENABLED 1
+#endif
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
 #include <functional>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <string>
+#include <type_traits>
+#include <utility>
 
 namespace ImGui
 {
 namespace CVLog
 {
 
+/*!
+ Compile-time version of ImHashStr(str), including the "###" handling.
+ 
+ Bitwise CRC32, so only meant to run at compile time, see CVLOG_HASHED.
+*/
+constexpr ImGuiID HashStr(const char* str)
+{
+    const ImU32 seed = ~ImU32(0);
+    ImU32 crc = seed;
+    for (const char* data = str; *data != '\0'; ++data)
+    {
+        if (data[0] == '#' && data[1] == '#' && data[2] == '#')
+            crc = seed;
+        crc ^= ImU32((unsigned char)*data);
+        for (int bit = 0; bit < 8; ++bit)
+            crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320u : (crc >> 1);
+    }
+    return ~crc;
+}
+
+/*!
+ A window or group name with its precomputed ID, to avoid hashing string
+ literals for every call. Build it with CVLOG_HASHED("MyName").
+*/
+struct HashedName
+{
+    constexpr HashedName(const char* name, ImGuiID id) : name(name), id(id) {}
+    
+    const char* name;
+    ImGuiID id; // == ImHashStr(name)
+};
+
+#define CVLOG_HASHED(Literal) \
+    ImGui::CVLog::HashedName(Literal, std::integral_constant<ImGuiID, ImGui::CVLog::HashStr(Literal)>::value)
+
+// Backs IsEnabled, use SetEnabled to change it.
+extern std::atomic<bool> g_LoggingEnabled;
+
+/*!
+ Runtime switch for the CVLOG_* macros defined at the end of this file.
+ When disabled they only cost a single branch and don't evaluate their arguments.
+ The functions called directly are not affected.
+ 
+ - Thread safety: any thread.
+ */
+void SetEnabled(bool enabled);
+
+inline bool IsEnabled() { return g_LoggingEnabled.load(std::memory_order_relaxed); }
+
 /*!
  Call this once per ImGui context.
  Required to create the settings handler.
@@ -84,6 +151,75 @@ void SetWindowProperties(const char* windowName,
                          int preferredWidth = -1, /* -1 for no change */
                          int preferredHeight = -1 /* -1 for no change */);
 
+/*!
+ Limits the updates that producers send to a window, e.g. a camera sending
+ images at 500 Hz while the UI shows at most 60 of them.
+ Rejected updates get dropped by the producer before any copy or lock.
+*/
+struct UpdatePolicy
+{
+    float maxUpdatesPerSecond = 0.f; // 0 for no limit.
+    int keepEveryNth = 1; // e.g. 2 to drop every other update.
+    bool keepLatestOnly = false; // only keep the last update of each frame, per plot group for plots, replaced in place by the producers.
+};
+
+/*!
+ Set the update policy of a window. The window does not have to exist yet.
+ 
+- Thread safety: any thread.
+*/
+void SetWindowUpdatePolicy(const char* windowName, const UpdatePolicy& policy);
+
+/*!
+ Frame budget mode: when rendering all the windows would take more than budgetMs,
+ the lower priority windows get refreshed round-robin on later frames and show
+ their last content meanwhile (see Window::RenderStale). A window does not stay
+ stale for more than maxStaleFrames frames. 0 to disable it, the default.
+ 
+- Thread safety: any thread.
+*/
+void SetFrameBudget(float budgetMs, int maxStaleFrames = 10);
+
+/*!
+ Higher priority windows get refreshed first in frame budget mode. 0 by default.
+ The window does not have to exist yet.
+ 
+- Thread safety: any thread.
+*/
+void SetWindowPriority(const char* windowName, int priority);
+
+/*!
+ Pull mode: register a callback sending the data of a window, e.g. with UpdateImage,
+ instead of pushing it all the time. It only gets called when the window is
+ effectively visible (see WindowIsVisible) and at least refreshIntervalInSeconds
+ after its previous call. It also gets called until the window exists, so it can create it.
+ 
+ Pass an empty callback to remove it.
+ 
+- Thread safety: any thread. The callback runs in the ImGui thread, or in a
+  worker thread if runInWorkerThread is true. A worker callback never runs
+  concurrently with itself.
+*/
+void SetWindowProvider(const char* windowName,
+                       const std::function<void(void)>& provider,
+                       double refreshIntervalInSeconds = 0.0,
+                       bool runInWorkerThread = false);
+
+/*!
+ Run f in the worker threads shared with the window providers, e.g. to prepare
+ the data of a custom window without blocking the ImGui thread.
+ 
+- Thread safety: any thread.
+*/
+void RunInWorkerThread(const std::function<void(void)>& f);
+
+/*!
+ Add a section to the diagnostics window, opened from the CVLog menu.
+ 
+- Thread safety: any thread. The callback runs in the ImGui thread.
+*/
+void AddDiagnosticsCallback(const char* name, const std::function<void(void)>& callback);
+
 /*!
  Run arbitrary code in the ImGui thread.
  
@@ -93,6 +229,273 @@ void SetWindowProperties(const char* windowName,
 */
 void RunOnceInImGuiThread(const std::function<void(void)>& f);
 
+/*!
+ True when called from the thread that renders the windows, e.g. from a
+ window creation task or a provider that does not run in a worker.
+ 
+- Thread safety: any thread.
+*/
+bool IsImGuiThread();
+
+class FrameArena;
+struct FrameArenaPage;
+
+/*!
+ Memory owned by a Task, typically to copy the strings it captures.
+ 
+ It is a lease on a per-frame arena that Render() recycles in bulk once all
+ the tasks using it were run, so the producers do not hit the heap. Falls
+ back to heap allocations if the arena is full or the lease is empty.
+ 
+ - Thread safety: acquire() from any thread, then only use it from one thread at a time.
+*/
+class TaskStorage
+{
+public:
+    TaskStorage() = default; // empty lease, allocations will go to the heap.
+    TaskStorage(TaskStorage&& rhs) { swap(rhs); }
+    TaskStorage& operator=(TaskStorage&& rhs) { TaskStorage tmp(std::move(rhs)); swap(tmp); return *this; }
+    TaskStorage(const TaskStorage&) = delete;
+    TaskStorage& operator=(const TaskStorage&) = delete;
+    ~TaskStorage();
+    
+    static TaskStorage acquire();
+    
+    void* allocate(size_t size, size_t alignment = alignof(std::max_align_t));
+    
+    // nullptr stays nullptr.
+    const char* copyString(const char* str);
+    
+    // Only for trivially copyable types, nullptr stays nullptr.
+    template <class T>
+    const T* copyArray(const T* values, size_t count)
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "use allocate and placement new");
+        if (!values)
+            return nullptr;
+        void* copy = allocate(sizeof(T)*count, alignof(T));
+        memcpy(copy, values, sizeof(T)*count);
+        return static_cast<const T*>(copy);
+    }
+    
+private:
+    friend class FrameArena;
+    TaskStorage(FrameArenaPage* page) : _page(page) {}
+    
+    void swap(TaskStorage& rhs)
+    {
+        std::swap(_page, rhs._page);
+        std::swap(_heapBlocks, rhs._heapBlocks);
+    }
+    
+private:
+    struct HeapBlock;
+    FrameArenaPage* _page = nullptr;
+    HeapBlock* _heapBlocks = nullptr;
+};
+
+/*!
+ Move-only callable used for the tasks run in the ImGui thread.
+ 
+ Small callables are stored inline, the bigger ones go into the TaskStorage.
+ 
+ - Thread safety: create it anywhere, it'll get run and destroyed in the ImGui thread.
+*/
+class Task
+{
+public:
+    static constexpr size_t inlineSize = 64;
+    
+public:
+    Task() = default;
+    
+    template <class F, class = typename std::enable_if<!std::is_same<typename std::decay<F>::type, Task>::value>::type>
+    explicit Task(F&& f) : Task(TaskStorage(), std::forward<F>(f)) {}
+    
+    template <class F>
+    Task(TaskStorage&& storage, F&& f)
+    : _storage(std::move(storage))
+    {
+        using Callable = typename std::decay<F>::type;
+        static const VTable vtable = {
+            [](void* callable) { (*static_cast<Callable*>(callable))(); },
+            [](void* callable) { static_cast<Callable*>(callable)->~Callable(); },
+            [](void* src, void* dst) { new (dst) Callable(std::move(*static_cast<Callable*>(src))); },
+        };
+        
+        constexpr bool fitsInline = sizeof(Callable) <= inlineSize
+                                    && alignof(Callable) <= alignof(std::max_align_t)
+                                    && std::is_nothrow_move_constructible<Callable>::value;
+        void* memory = fitsInline ? static_cast<void*>(_inline) : _storage.allocate(sizeof(Callable), alignof(Callable));
+        _callable = new (memory) Callable(std::forward<F>(f));
+        _vtable = &vtable;
+    }
+    
+    Task(Task&& rhs) { moveFrom(rhs); }
+    Task& operator=(Task&& rhs)
+    {
+        if (this != &rhs)
+        {
+            reset();
+            moveFrom(rhs);
+        }
+        return *this;
+    }
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+    
+    ~Task() { reset(); }
+    
+    explicit operator bool() const { return _callable != nullptr; }
+    
+    void operator()() { _vtable->invoke(_callable); }
+    
+private:
+    struct VTable
+    {
+        void (*invoke)(void* callable);
+        void (*destroy)(void* callable);
+        void (*moveTo)(void* src, void* dst);
+    };
+    
+    bool isInline() const { return _callable == static_cast<const void*>(_inline); }
+    
+    void moveFrom(Task& rhs)
+    {
+        if (!rhs._callable)
+            return;
+        
+        if (rhs.isInline())
+        {
+            rhs._vtable->moveTo(rhs._callable, _inline);
+            rhs._vtable->destroy(rhs._callable);
+            _callable = _inline;
+        }
+        else
+        {
+            _callable = rhs._callable;
+        }
+        _vtable = rhs._vtable;
+        _storage = std::move(rhs._storage);
+        rhs._callable = nullptr;
+        rhs._vtable = nullptr;
+    }
+    
+    void reset()
+    {
+        if (_callable)
+            _vtable->destroy(_callable);
+        _callable = nullptr;
+        _vtable = nullptr;
+        _storage = TaskStorage();
+    }
+    
+private:
+    alignas(std::max_align_t) unsigned char _inline[inlineSize];
+    void* _callable = nullptr;
+    const VTable* _vtable = nullptr;
+    TaskStorage _storage;
+};
+
+/*!
+ Same as above, but the task can avoid heap allocations by copying what it
+ needs into a TaskStorage.
+ 
+- Thread safety: any thread.
+*/
+void RunOnceInImGuiThread(Task&& task);
+
+/*!
+ What to do when a queue is full, e.g. when the ImGui thread stalls.
+*/
+enum class QueuePolicy
+{
+    DropOldest,
+    DropNewest,
+    Block, // wait for the ImGui thread up to blockTimeoutInSeconds, then drop the newest.
+};
+
+struct QueueLimits
+{
+    size_t capacity = 0; // 0 for no limit.
+    QueuePolicy policy = QueuePolicy::DropOldest;
+    double blockTimeoutInSeconds = 0.1;
+};
+
+/*!
+ Bound the number of tasks waiting for the next Render(). Unlimited by default,
+ since dropping tasks can also drop the creation of windows.
+ Tasks sent from the ImGui thread itself never block nor get dropped.
+ Dropped tasks get destroyed in the producer thread.
+ 
+ - Thread safety: any thread.
+*/
+void SetTaskQueueLimits(const QueueLimits& limits);
+
+/*!
+ Counters of the queue used by RunOnceInImGuiThread, mostly useful to
+ monitor the producer side contention.
+
+ - Thread safety: any thread.
+*/
+struct TaskQueueStats
+{
+    size_t capacity = 0; // QueueLimits::capacity, or ringCapacity when unlimited.
+    size_t ringCapacity = 0; // lock-free part, the rest goes to the overflow list.
+    size_t approximateSize = 0; // tasks waiting for the next Render(), overflow included.
+
+    uint64_t numEnqueued = 0;
+    uint64_t numContendedEnqueues = 0; // had to retry at least once.
+    uint64_t numRetries = 0; // total number of failed attempts to grab a slot.
+    uint64_t numOverflows = 0; // queue was full, went through the slow path.
+    uint64_t numDropped = 0; // rejected or evicted because of the QueueLimits.
+    uint64_t numBlocked = 0; // had to wait with QueuePolicy::Block.
+    uint64_t numHeapAllocations = 0; // TaskStorage allocations that did not fit in the frame arena.
+
+    // Sampled once every 64 enqueues per thread, and on every enqueue that
+    // found the queue full or overflowed, so the average leans towards the slow ones.
+    uint64_t numLatencySamples = 0;
+    uint64_t totalEnqueueLatencyNs = 0;
+    uint64_t maxEnqueueLatencyNs = 0;
+};
+TaskQueueStats GetTaskQueueStats();
+
+/*!
+ Flags that new data is waiting for the next Render(). The built-in producers
+ already call it, custom windows should call it when they receive new data.
+
+ The first call after a Render() also runs the wake up callback, so a render
+ loop sleeping on input events can be woken up.
+
+ - Thread safety: any thread.
+*/
+void RequestRedraw();
+
+/*!
+ True if RequestRedraw got called since the last Render().
+
+ - Thread safety: any thread.
+*/
+bool HasPendingRedraw();
+
+/*!
+ Called by RequestRedraw at most once per frame, e.g. to post an empty event
+ to the windowing system. Pass an empty function to remove it.
+
+ - Thread safety: any thread. The callback itself gets called from the producer
+   threads and must be thread-safe.
+*/
+void SetWakeUpCallback(const std::function<void(void)>& callback);
+
+/*!
+ Time until a window provider is due for a refresh (see SetWindowProvider).
+ A render loop that waits for new data should not sleep longer than that.
+ Returns a very large value when there is no periodic provider.
+
+ - Thread safety: ImGui thread only.
+*/
+double SecondsUntilNextScheduledUpdate();
+
 // API to implement custom window types
 
 class WindowData;
@@ -110,22 +513,56 @@ public:
     /// Implement ImGui rendering here. Called once per frame.
     virtual void Render() = 0;
     
+    /// Called instead of Render when the frame budget got exceeded, see SetFrameBudget.
+    /// Override it to show the last content without processing the new data,
+    /// e.g. without uploading a new texture.
+    virtual void RenderStale() { Render(); }
+    
     const char* name() const;
+    
+    /// False if the content can't be seen: hidden, collapsed, in a hidden tab,
+    /// fully covered or off-screen. Any thread.
     bool isVisible() const;
     
+    /// Call before sending new data, false if the window is not visible or if
+    /// its UpdatePolicy rejects it. Any thread.
+    bool acceptsUpdate() const;
+    
+    /// Only the rate limits of the UpdatePolicy, for windows that keep a state
+    /// instead of a stream, e.g. value lists: what gets sent while hidden would
+    /// never show up otherwise. Any thread.
+    bool passesUpdatePolicy() const;
+    
+    /// UpdatePolicy::keepLatestOnly, for the producers. Any thread.
+    bool keepsLatestUpdateOnly() const;
+    
+    /// ImGui thread only.
+    const UpdatePolicy& updatePolicy() const;
+    
+    /// For the diagnostics window, ImGui thread only.
+    void reportSamplesIngested(int numSamples);
+    void reportBytesUploaded(size_t numBytes);
+    
+    /// Locks a mutex shared by the producers and the ImGui thread. The wait
+    /// only gets measured for the diagnostics window when it's contended. Any thread.
+    std::unique_lock<std::mutex> lockMeasuringWait(std::mutex& mutex) const;
+    
 public:
     // Only access it from the ImGui thread, unless otherwise specified.
     WindowData* imGuiData = nullptr; // will get filled once added to the context.
 };
 
 /*!
- Returns whether a window is visible or not.
+ Returns whether the content of a window can be seen. This is false if it was
+ hidden from the window list, but also when it is collapsed, in a hidden tab,
+ fully covered by another window or off-screen. Updated once per frame.
  
  See CVLOG_FAST_VISIBLITY_CHECK for a fast direct access.
 
 - Thread safety: any thread.
 */
-bool WindowIsVisible(const char* windowName, bool** persistentAddressOfFlag = nullptr);
+bool WindowIsVisible(const char* windowName, const std::atomic<bool>** persistentAddressOfFlag = nullptr);
+bool WindowIsVisible(const HashedName& windowName, const std::atomic<bool>** persistentAddressOfFlag = nullptr);
 
 /*!
  Creates a static boolean with the direct address of the visible flag.
@@ -133,14 +570,20 @@ bool WindowIsVisible(const char* windowName, bool** persistentAddressOfFlag = nu
  This is faster than calling WindowIsVisible since it does not need to compute
  a hash nor grab a mutex to retrieve the window data.
 */
+#if CVLOG_ENABLED
+#define CVLOG_FAST_VISIBLITY_CHECK(BoolName, WindowName) \
+    static const std::atomic<bool>* BoolName##DirectPointer = nullptr; \
+    const bool BoolName = ImGui::CVLog::IsEnabled() && (BoolName##DirectPointer ? BoolName##DirectPointer->load(std::memory_order_relaxed) : ImGui::CVLog::WindowIsVisible(WindowName, &BoolName##DirectPointer));
+#else
 #define CVLOG_FAST_VISIBLITY_CHECK(BoolName, WindowName) \
-    static bool* BoolName##DirectPointer = nullptr; \
-    const bool BoolName = (BoolName##DirectPointer ? *BoolName##DirectPointer : ImGui::CVLog::WindowIsVisible(WindowName, &BoolName##DirectPointer));
+    const bool BoolName = false;
+#endif
 
 /*!
 - Thread safety: any thread.
 */
 Window* FindWindow(const char* windowName);
+Window* FindWindow(const HashedName& windowName);
 
 /*!
 - Thread safety: any thread.
@@ -148,6 +591,9 @@ Window* FindWindow(const char* windowName);
 template <class WindowType>
 WindowType* FindWindow (const char* name) { return dynamic_cast<WindowType*>(FindWindow(name)); }
 
+template <class WindowType>
+WindowType* FindWindow (const HashedName& name) { return dynamic_cast<WindowType*>(FindWindow(name)); }
+
 /*!
 - Thread safety: only from the ImGui thread.
 */
@@ -167,5 +613,87 @@ WindowType* FindOrCreateWindow (const char* windowName)
     return concreteWindow;
 }
 
+/*!
+ Typed reference to a window, resolved once with GetWindowHandle and then
+ reusable from any thread without hashing the name, looking it up nor
+ casting the window.
+ 
+ The window gets created in the ImGui thread, so window() will return
+ nullptr until the next frame if it did not exist yet.
+ 
+ - Thread safety: any thread.
+*/
+template <class WindowType>
+class WindowHandle
+{
+public:
+    WindowHandle() = default;
+    
+    explicit operator bool() const { return _slot != nullptr; }
+    
+    WindowType* window() const { return _slot ? _slot->window.load(std::memory_order_acquire) : nullptr; }
+    const char* name() const { return _slot ? _slot->name.c_str() : nullptr; }
+    
+private:
+    struct Slot
+    {
+        std::atomic<WindowType*> window { nullptr };
+        std::string name;
+    };
+    std::shared_ptr<Slot> _slot;
+    
+    template <class T>
+    friend WindowHandle<T> GetWindowHandle(const char* windowName);
+};
+
+/*!
+ Creates the window if it does not exist yet.
+ 
+ - Thread safety: any thread.
+*/
+template <class WindowType>
+WindowHandle<WindowType> GetWindowHandle(const char* windowName)
+{
+    WindowHandle<WindowType> handle;
+    handle._slot = std::make_shared<typename WindowHandle<WindowType>::Slot>();
+    handle._slot->name = windowName;
+    
+    WindowType* window = FindWindow<WindowType>(windowName);
+    if (window)
+    {
+        handle._slot->window.store(window, std::memory_order_release);
+        return handle;
+    }
+    
+    auto slot = handle._slot;
+    RunOnceInImGuiThread([slot]() {
+        slot->window.store(FindOrCreateWindow<WindowType>(slot->name.c_str()), std::memory_order_release);
+    });
+    return handle;
+}
+
 } // CVLog
 } // ImGui
+
+/*!
+ Macro versions of the producer functions. They don't evaluate their arguments
+ when disabled with SetEnabled(false), and compile to nothing when CVLOG_ENABLED is 0.
+ 
+ CVLOG can wrap any statement, e.g. some code building an image only for logging:
+     CVLOG(cv::Mat edges = computeEdges(image); ImGui::CVLog::UpdateImage("Edges", edges));
+*/
+#if CVLOG_ENABLED
+#define CVLOG(...) do { if (ImGui::CVLog::IsEnabled()) { __VA_ARGS__; } } while (0)
+#else
+#define CVLOG(...) do {} while (0)
+#endif
+
+#define CVLOG_CLEAR_WINDOW(...) CVLOG(ImGui::CVLog::ClearWindow(__VA_ARGS__))
+#define CVLOG_CREATE_EMPTY_WINDOW(...) CVLOG(ImGui::CVLog::CreateEmptyWindow(__VA_ARGS__))
+#define CVLOG_SET_PER_FRAME_CALLBACK(...) CVLOG(ImGui::CVLog::SetPerFrameCallback(__VA_ARGS__))
+#define CVLOG_SET_WINDOW_PRE_RENDER_CALLBACK(...) CVLOG(ImGui::CVLog::SetWindowPreRenderCallback(__VA_ARGS__))
+#define CVLOG_ADD_MENU_BAR_CALLBACK(...) CVLOG(ImGui::CVLog::AddMenuBarCallback(__VA_ARGS__))
+#define CVLOG_SET_WINDOW_PROPERTIES(...) CVLOG(ImGui::CVLog::SetWindowProperties(__VA_ARGS__))
+#define CVLOG_SET_WINDOW_UPDATE_POLICY(...) CVLOG(ImGui::CVLog::SetWindowUpdatePolicy(__VA_ARGS__))
+#define CVLOG_RUN_ONCE_IN_IMGUI_THREAD(...) CVLOG(ImGui::CVLog::RunOnceInImGuiThread(__VA_ARGS__))
+#define CVLOG_SET_WINDOW_PROVIDER(...) CVLOG(ImGui::CVLog::SetWindowProvider(__VA_ARGS__))